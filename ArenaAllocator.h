@@ -0,0 +1,399 @@
+/*----------------------------------------------------
+ArenaAllocator.h
+
+Linear arena allocator that frees everything at once.
+----------------------------------------------------*/
+#ifndef ArenaAllocator_h
+#define ArenaAllocator_h
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include "ObjectAllocator.h"
+#include "PageSource.h"
+
+namespace MemoryManager
+{
+  // Settings for ArenaAllocator
+  struct ArenaAllocatorSettings
+  {
+    // Size of each page. Must be a power of two. Larger allocations get a page of their own.
+    std::size_t pageSize = 64 * 1024;
+
+    // Source of page memory. Uses HeapPageSource if null. Must outlive the allocator.
+    PageSource * pageSource = nullptr;
+  };
+
+  // Position in an arena. Rewinding to it frees everything allocated after it was taken.
+  struct ArenaMarker
+  {
+    // Page being allocated from.
+    void *          page = nullptr;
+
+    // Next free byte of the page.
+    unsigned char * top = nullptr;
+
+    // Most recently registered destructor.
+    void *          destructors = nullptr;
+
+    // Most recently allocated large block.
+    void *          largeBlocks = nullptr;
+  };
+
+  /*
+    Allocates by bumping a pointer through a chain of pages, and frees everything at once with
+    Reset(), or everything since a marker with Rewind(). Pages are kept for reuse, so a Reset()
+    only moves the bump pointer back to the first page. Objects are not destroyed unless their
+    destructor was registered, which MM_ARENA_ALLOC does for types that are not trivially
+    destructible. Not thread-safe.
+  */
+  class ArenaAllocator
+  {
+    // Header at the start of every page.
+    struct PageHeader
+    {
+      // Next page in the chain.
+      PageHeader *  next;
+    };
+
+    // Header of an allocation too large for a page. Each has a page of its own.
+    struct LargeBlock
+    {
+      // Previously allocated large block.
+      LargeBlock *  next;
+
+      // Size of its page.
+      std::size_t   size;
+    };
+
+    // Destructor to run when the arena is rewound past its object.
+    struct Destructor
+    {
+      // Destroys the object.
+      void          (*destroy)(void * object);
+
+      // The object.
+      void *        object;
+
+      // Previously registered destructor.
+      Destructor *  next;
+    };
+
+    // Prevent copy and assignment.
+    ArenaAllocator(ArenaAllocator const & rhs) = delete;
+    ArenaAllocator & operator=(ArenaAllocator const & rhs) = delete;
+
+    // Settings for the allocator.
+    ArenaAllocatorSettings  settings;
+
+    // First page of the chain.
+    PageHeader *            pages;
+
+    // Page being allocated from, or null before the first allocation.
+    PageHeader *            current;
+
+    // Next free byte of the current page.
+    unsigned char *         top;
+
+    // End of the current page.
+    unsigned char *         end;
+
+    // Registered destructors, most recent first.
+    Destructor *            destructors;
+
+    // Large blocks, most recent first.
+    LargeBlock *            largeBlocks;
+
+  public:
+    /*
+      Constructor.
+      settings - settings for the allocator
+    */
+    ArenaAllocator(ArenaAllocatorSettings settings = ArenaAllocatorSettings()) :
+      settings(settings),
+      pages(nullptr),
+      current(nullptr),
+      top(nullptr),
+      end(nullptr),
+      destructors(nullptr),
+      largeBlocks(nullptr)
+    {
+      if (this->settings.pageSource == nullptr)
+      {
+        this->settings.pageSource = &HeapPageSource::Instance();
+      }
+      assert(NextPowerOfTwo(this->settings.pageSize) == this->settings.pageSize);
+    }
+
+    // Destructor. Runs registered destructors and releases every page.
+    ~ArenaAllocator()
+    {
+      Reset();
+      Trim();
+      if (pages != nullptr)
+      {
+        settings.pageSource->ReleasePage(pages, settings.pageSize, settings.pageSize);
+      }
+    }
+
+    /*
+      Allocates a block.
+      size      - size of the block
+      alignment - alignment of the block. Must be a power of two.
+    */
+    inline void * Allocate(std::size_t size, std::size_t alignment = alignof(std::max_align_t))
+    {
+      std::uintptr_t p = (reinterpret_cast<std::uintptr_t>(top) + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1);
+      if (top != nullptr && p + size <= reinterpret_cast<std::uintptr_t>(end))
+      {
+        top = reinterpret_cast<unsigned char *>(p + size);
+#ifdef MEMORYMANAGER_DEBUG
+        std::memset(reinterpret_cast<void *>(p), ALLOCATED, size);
+#endif
+        return reinterpret_cast<void *>(p);
+      }
+      return AllocateSlow(size, alignment);
+    }
+
+    /*
+      Registers the destructor of an object in the arena, to run when the arena is rewound past it.
+      Does nothing for trivially destructible types. Returns the object.
+      object - the object
+    */
+    template <typename T>
+    inline T * RegisterDestructor(T * object)
+    {
+      if constexpr (!std::is_trivially_destructible<T>::value)
+      {
+        Destructor * destructor = static_cast<Destructor *>(Allocate(sizeof(Destructor), alignof(Destructor)));
+        destructor->destroy = [](void * p) { static_cast<T *>(p)->~T(); };
+        destructor->object = object;
+        destructor->next = destructors;
+        destructors = destructor;
+      }
+      return object;
+    }
+
+    // Gets a marker for the current position.
+    inline ArenaMarker GetMarker() const
+    {
+      ArenaMarker marker;
+      marker.page = current;
+      marker.top = top;
+      marker.destructors = destructors;
+      marker.largeBlocks = largeBlocks;
+      return marker;
+    }
+
+    /*
+      Frees everything allocated since a marker was taken. Runs the destructors registered since then,
+      most recent first, and releases large blocks. Pages stay in the chain for reuse.
+      marker - a marker taken from this arena since the last Reset(), and not rewound past
+    */
+    void Rewind(ArenaMarker const & marker)
+    {
+      Destructor * stop = static_cast<Destructor *>(marker.destructors);
+      while (destructors != stop)
+      {
+        Destructor * destructor = destructors;
+        destructors = destructor->next;
+        destructor->destroy(destructor->object);
+      }
+
+      LargeBlock * keep = static_cast<LargeBlock *>(marker.largeBlocks);
+      while (largeBlocks != keep)
+      {
+        LargeBlock * block = largeBlocks;
+        largeBlocks = block->next;
+        settings.pageSource->ReleasePage(block, block->size, settings.pageSize);
+      }
+
+#ifdef MEMORYMANAGER_DEBUG
+      //Mark the freed range of every page up to the current one
+      PageHeader * page = marker.page != nullptr ? static_cast<PageHeader *>(marker.page) : pages;
+      unsigned char * from = marker.top;
+      while (page != nullptr && current != nullptr)
+      {
+        if (from == nullptr)
+        {
+          from = GetPageStart(page);
+        }
+        unsigned char * to = page == current ? top : GetPageEnd(page);
+        if (from < to)
+        {
+          std::memset(from, FREED, to - from);
+        }
+        if (page == current)
+        {
+          break;
+        }
+        page = page->next;
+        from = nullptr;
+      }
+#endif
+
+      current = static_cast<PageHeader *>(marker.page);
+      top = marker.top;
+      end = current != nullptr ? GetPageEnd(current) : nullptr;
+    }
+
+    // Frees everything in the arena. Runs registered destructors and releases large blocks.
+    inline void Reset()
+    {
+      Rewind(ArenaMarker());
+    }
+
+    /*
+      Returns the pages past the current one to the page source. Returns the number of pages released.
+      The first page is kept until the arena is destroyed.
+    */
+    unsigned Trim()
+    {
+      PageHeader * last = current != nullptr ? current : pages;
+      if (last == nullptr)
+      {
+        return 0;
+      }
+
+      unsigned released = 0;
+      PageHeader * page = last->next;
+      last->next = nullptr;
+      while (page != nullptr)
+      {
+        PageHeader * next = page->next;
+        settings.pageSource->ReleasePage(page, settings.pageSize, settings.pageSize);
+        page = next;
+        ++released;
+      }
+      return released;
+    }
+
+  private:
+    // Gets the first usable byte of a page.
+    inline static unsigned char * GetPageStart(PageHeader * page)
+    {
+      return reinterpret_cast<unsigned char *>(page) + sizeof(PageHeader);
+    }
+
+    // Gets the end of a page.
+    inline unsigned char * GetPageEnd(PageHeader * page) const
+    {
+      return reinterpret_cast<unsigned char *>(page) + settings.pageSize;
+    }
+
+    // Allocates a block that does not fit in the current page.
+    void * AllocateSlow(std::size_t size, std::size_t alignment)
+    {
+      //Blocks too large for a page get a page of their own
+      if (sizeof(PageHeader) + alignment + size > settings.pageSize)
+      {
+        std::size_t offset = (sizeof(LargeBlock) + alignment - 1) & ~(alignment - 1);
+        std::size_t pageSize = offset + size;
+        LargeBlock * block = static_cast<LargeBlock *>(settings.pageSource->AllocatePage(pageSize, settings.pageSize));
+        if (block == nullptr)
+        {
+          throw std::bad_alloc();
+        }
+        block->next = largeBlocks;
+        block->size = pageSize;
+        largeBlocks = block;
+#ifdef MEMORYMANAGER_DEBUG
+        std::memset(reinterpret_cast<unsigned char *>(block) + offset, ALLOCATED, size);
+#endif
+        return reinterpret_cast<unsigned char *>(block) + offset;
+      }
+
+      //Move on to the next page of the chain, adding one if there is none
+      PageHeader * next = current != nullptr ? current->next : pages;
+      if (next == nullptr)
+      {
+        next = static_cast<PageHeader *>(settings.pageSource->AllocatePage(settings.pageSize, settings.pageSize));
+        if (next == nullptr)
+        {
+          throw std::bad_alloc();
+        }
+        next->next = nullptr;
+        if (current != nullptr)
+        {
+          current->next = next;
+        }
+        else
+        {
+          pages = next;
+        }
+      }
+
+      current = next;
+      top = GetPageStart(current);
+      end = GetPageEnd(current);
+      return Allocate(size, alignment);
+    }
+  };
+
+  /*
+    Rewinds an arena to where it was when the scope was created, when the scope ends.
+    Scopes can be nested.
+  */
+  class ArenaScope
+  {
+    // Prevent copy and assignment.
+    ArenaScope(ArenaScope const & rhs) = delete;
+    ArenaScope & operator=(ArenaScope const & rhs) = delete;
+
+    // The arena.
+    ArenaAllocator &  arena;
+
+    // Position to rewind to.
+    ArenaMarker       marker;
+
+  public:
+    // Takes a marker of the arena.
+    explicit ArenaScope(ArenaAllocator & arena) :
+      arena(arena),
+      marker(arena.GetMarker())
+    {
+    }
+
+    // Rewinds the arena to the marker.
+    ~ArenaScope()
+    {
+      arena.Rewind(marker);
+    }
+  };
+
+  // Gets the alignment of an object of the given size allocated with new. An alignment always divides its type's size.
+  inline std::size_t GetArenaAlignment(std::size_t size)
+  {
+    std::size_t alignment = size & (~size + 1);
+    return alignment == 0 || alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? __STDCPP_DEFAULT_NEW_ALIGNMENT__ : alignment;
+  }
+}
+
+// Placement new from an arena. Used by MM_ARENA_ALLOC.
+inline void * operator new(std::size_t size, MemoryManager::ArenaAllocator & arena)
+{
+  return arena.Allocate(size, MemoryManager::GetArenaAlignment(size));
+}
+
+// Placement new from an arena for over-aligned types.
+inline void * operator new(std::size_t size, std::align_val_t alignment, MemoryManager::ArenaAllocator & arena)
+{
+  return arena.Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+// Called if a constructor throws. The memory is freed with the arena.
+inline void operator delete(void *, MemoryManager::ArenaAllocator &)
+{
+}
+
+// Called if a constructor of an over-aligned type throws.
+inline void operator delete(void *, std::align_val_t, MemoryManager::ArenaAllocator &)
+{
+}
+
+#define MM_ARENA_ALLOC(arena, constructor) ((arena).RegisterDestructor(new (arena) constructor))
+
+#endif // ArenaAllocator_h
@@ -0,0 +1,463 @@
+/*----------------------------------------------------
+Benchmark.cpp
+
+Compares ObjectAllocator and SmallObjectAllocator with new/delete,
+malloc and std::pmr::unsynchronized_pool_resource, and Pointer<T>
+with std::shared_ptr and std::unique_ptr. Each subject runs LIFO,
+FIFO and random free orders and a churn workload for several object
+sizes. Reports ns per allocate/free pair, the growth of the resident
+set and, on Linux, cache misses counted with perf_event_open.
+
+Output is one JSON object per line, so runs can be diffed. Build both
+configurations to compare debug and release:
+  g++ -std=c++17 -O2 -I. Benchmarks/Benchmark.cpp MemoryHandle.cpp -o Benchmark
+  g++ -std=c++17 -O2 -DMEMORYMANAGER_DEBUG -I. Benchmarks/Benchmark.cpp MemoryHandle.cpp -o BenchmarkDebug
+
+Usage:
+  Benchmark [live objects] [rounds] [--text]
+----------------------------------------------------*/
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <memory_resource>
+#include <random>
+#include <vector>
+#include "../ObjectAllocator.h"
+#include "../SmallObjectAllocator.h"
+#include "../Pointer.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Object of the given size.
+  template <std::size_t Size>
+  struct Object
+  {
+    unsigned char bytes[Size];
+
+    explicit Object(unsigned value) { bytes[0] = static_cast<unsigned char>(value); }
+  };
+
+  // Counts hardware cache misses of the process. Unavailable when perf_event_open is not supported or not permitted.
+  class CacheMissCounter
+  {
+    // Counter file descriptor, or -1.
+    int fd = -1;
+
+  public:
+    CacheMissCounter()
+    {
+#ifdef __linux__
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+#endif
+    }
+
+    ~CacheMissCounter()
+    {
+#ifdef __linux__
+      if (fd >= 0)
+      {
+        close(fd);
+      }
+#endif
+    }
+
+    bool Available() const { return fd >= 0; }
+
+    void Start()
+    {
+#ifdef __linux__
+      if (fd >= 0)
+      {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+    }
+
+    std::uint64_t Stop()
+    {
+      std::uint64_t count = 0;
+#ifdef __linux__
+      if (fd >= 0)
+      {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &count, sizeof(count)) != sizeof(count))
+        {
+          count = 0;
+        }
+      }
+#endif
+      return count;
+    }
+  };
+
+  // Gets the resident set size of the process in kilobytes, or 0 if unknown.
+  long ResidentKB()
+  {
+#ifdef __linux__
+    long pages = 0;
+    long resident = 0;
+    FILE * statm = std::fopen("/proc/self/statm", "r");
+    if (statm != nullptr)
+    {
+      if (std::fscanf(statm, "%ld %ld", &pages, &resident) != 2)
+      {
+        resident = 0;
+      }
+      std::fclose(statm);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return 0;
+#endif
+  }
+
+  // Order in which a workload frees its objects.
+  enum class Order { Lifo, Fifo, Random, Churn };
+
+  char const * OrderName(Order order)
+  {
+    switch (order)
+    {
+    case Order::Lifo: return "lifo";
+    case Order::Fifo: return "fifo";
+    case Order::Random: return "random";
+    default: return "churn";
+    }
+  }
+
+  // Result of one run.
+  struct Result
+  {
+    char const *  subject;
+    std::size_t   size;
+    Order         order;
+    double        nsPerOp;
+    long          rssKB;
+    double        cacheMissesPerOp;
+  };
+
+  // Settings shared by every run.
+  struct Config
+  {
+    unsigned  liveObjects = 10000;
+    unsigned  rounds = 100;
+    bool      text = false;
+  };
+
+  // Cache miss counter shared by every run.
+  CacheMissCounter cacheMisses;
+
+  void Report(Config const & config, Result const & result)
+  {
+#ifdef MEMORYMANAGER_DEBUG
+    char const * build = "debug";
+#else
+    char const * build = "release";
+#endif
+    if (config.text)
+    {
+      std::printf("%-8s %-24s %5zu %-7s %9.2f ns %8ld KB", build, result.subject, result.size, OrderName(result.order), result.nsPerOp, result.rssKB);
+      if (cacheMisses.Available())
+      {
+        std::printf(" %8.3f misses/op", result.cacheMissesPerOp);
+      }
+      std::printf("\n");
+      return;
+    }
+
+    std::printf("{\"build\":\"%s\",\"subject\":\"%s\",\"size\":%zu,\"order\":\"%s\",\"ns_per_op\":%.3f,\"rss_delta_kb\":%ld,\"cache_misses_per_op\":",
+      build, result.subject, result.size, OrderName(result.order), result.nsPerOp, result.rssKB);
+    if (cacheMisses.Available())
+    {
+      std::printf("%.4f}\n", result.cacheMissesPerOp);
+    }
+    else
+    {
+      std::printf("null}\n");
+    }
+  }
+
+  /*
+    Runs a workload on a subject. Subjects create and destroy objects through handles:
+      Handle Allocate(unsigned value)
+      void Free(Handle & handle)
+      static unsigned Read(Handle const & handle)
+  */
+  template <typename Subject>
+  Result Run(Config const & config, char const * name, std::size_t size, Order order)
+  {
+    typedef typename Subject::Handle Handle;
+
+    long baseline = ResidentKB();
+    long peak = baseline;
+    Subject subject;
+    std::vector<Handle> handles(config.liveObjects);
+
+    //Fixed permutation for random frees and churn
+    std::vector<unsigned> permutation(config.liveObjects);
+    for (unsigned i = 0; i < config.liveObjects; ++i)
+    {
+      permutation[i] = i;
+    }
+    std::shuffle(permutation.begin(), permutation.end(), std::mt19937(42));
+
+    unsigned checksum = 0;
+    std::uint64_t operations = 0;
+    cacheMisses.Start();
+    auto start = std::chrono::steady_clock::now();
+    if (order == Order::Churn)
+    {
+      for (unsigned i = 0; i < config.liveObjects; ++i)
+      {
+        handles[i] = subject.Allocate(i);
+      }
+      peak = std::max(peak, ResidentKB());
+
+      for (unsigned round = 0; round < config.rounds; ++round)
+      {
+        for (unsigned i = 0; i < config.liveObjects; ++i)
+        {
+          Handle & handle = handles[permutation[(i * 7 + round) % config.liveObjects]];
+          checksum += Subject::Read(handle);
+          subject.Free(handle);
+          handle = subject.Allocate(i);
+        }
+      }
+      operations = std::uint64_t(config.rounds) * config.liveObjects;
+
+      for (Handle & handle : handles)
+      {
+        subject.Free(handle);
+      }
+    }
+    else
+    {
+      for (unsigned round = 0; round < config.rounds; ++round)
+      {
+        for (unsigned i = 0; i < config.liveObjects; ++i)
+        {
+          handles[i] = subject.Allocate(i);
+        }
+        if (round == 0)
+        {
+          peak = std::max(peak, ResidentKB());
+        }
+
+        for (unsigned i = 0; i < config.liveObjects; ++i)
+        {
+          unsigned index = order == Order::Lifo ? config.liveObjects - 1 - i : order == Order::Fifo ? i : permutation[i];
+          checksum += Subject::Read(handles[index]);
+          subject.Free(handles[index]);
+        }
+      }
+      operations = std::uint64_t(config.rounds) * config.liveObjects;
+    }
+    auto end = std::chrono::steady_clock::now();
+    std::uint64_t misses = cacheMisses.Stop();
+
+    //Keep the reads from being optimized away
+    if (checksum == 0xFFFFFFFFu)
+    {
+      std::printf("\n");
+    }
+
+    Result result;
+    result.subject = name;
+    result.size = size;
+    result.order = order;
+    result.nsPerOp = std::chrono::duration<double, std::nano>(end - start).count() / double(operations);
+    result.rssKB = peak - baseline;
+    result.cacheMissesPerOp = double(misses) / double(operations);
+    return result;
+  }
+
+  // new and delete.
+  template <typename T>
+  struct NewDelete
+  {
+    typedef T * Handle;
+    Handle Allocate(unsigned value) { return new T(value); }
+    void Free(Handle & handle) { delete handle; }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // malloc and free.
+  template <typename T>
+  struct Malloc
+  {
+    typedef T * Handle;
+    Handle Allocate(unsigned value) { return new (std::malloc(sizeof(T))) T(value); }
+    void Free(Handle & handle) { handle->~T(); std::free(handle); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // std::pmr::unsynchronized_pool_resource.
+  template <typename T>
+  struct PmrPool
+  {
+    typedef T * Handle;
+    std::pmr::unsynchronized_pool_resource pool;
+    Handle Allocate(unsigned value) { return new (pool.allocate(sizeof(T), alignof(T))) T(value); }
+    void Free(Handle & handle) { handle->~T(); pool.deallocate(handle, sizeof(T), alignof(T)); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // ObjectAllocator.
+  template <typename T>
+  struct ObjectPool
+  {
+    typedef T * Handle;
+    ObjectAllocator<T> allocator;
+    Handle Allocate(unsigned value) { return MM_ALLOC(allocator, T(value)); }
+    void Free(Handle & handle) { MM_FREE(allocator, handle); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // ObjectAllocator tracking free blocks with a bitmap.
+  template <typename T>
+  struct BitmapObjectPool
+  {
+    typedef T * Handle;
+    ObjectAllocator<T> allocator;
+#ifdef MEMORYMANAGER_DEBUG
+    BitmapObjectPool() : allocator(static_cast<std::ostream *>(nullptr), Settings()) {}
+#else
+    BitmapObjectPool() : allocator(Settings()) {}
+#endif
+    Handle Allocate(unsigned value) { return MM_ALLOC(allocator, T(value)); }
+    void Free(Handle & handle) { MM_FREE(allocator, handle); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+
+    static ObjectAllocatorSettings Settings()
+    {
+      ObjectAllocatorSettings settings;
+      settings.freeTracking = FreeTracking::Bitmap;
+      return settings;
+    }
+  };
+
+  // ObjectAllocator with its page layout fixed at compile time, matching the default settings.
+  template <typename T>
+  struct FixedObjectPool
+  {
+    typedef T * Handle;
+    ObjectAllocator<T, FixedLayout<1024>> allocator;
+    Handle Allocate(unsigned value) { return MM_ALLOC(allocator, T(value)); }
+    void Free(Handle & handle) { MM_FREE(allocator, handle); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // SmallObjectAllocator, freeing with the object size.
+  template <typename T>
+  struct SmallObjects
+  {
+    typedef T * Handle;
+    SmallObjectAllocator<256> allocator;
+    Handle Allocate(unsigned value) { return new (MM_SMALLOC(allocator, sizeof(T))) T(value); }
+    void Free(Handle & handle) { handle->~T(); MM_SFREE_SIZED(allocator, handle, sizeof(T)); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // Pointer<T> over an ObjectAllocator.
+  template <typename T>
+  struct ManagedPointer
+  {
+    typedef Pointer<T> Handle;
+    ObjectAllocator<T> allocator;
+    Handle Allocate(unsigned value) { return MM_PALLOC(allocator, T(value)); }
+    void Free(Handle & handle) { MM_PFREE(handle); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // std::shared_ptr created with std::make_shared.
+  template <typename T>
+  struct SharedPointer
+  {
+    typedef std::shared_ptr<T> Handle;
+    Handle Allocate(unsigned value) { return std::make_shared<T>(value); }
+    void Free(Handle & handle) { handle.reset(); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // std::unique_ptr created with std::make_unique.
+  template <typename T>
+  struct UniquePointer
+  {
+    typedef std::unique_ptr<T> Handle;
+    Handle Allocate(unsigned value) { return std::make_unique<T>(value); }
+    void Free(Handle & handle) { handle.reset(); }
+    static unsigned Read(Handle const & handle) { return handle->bytes[0]; }
+  };
+
+  // Runs every subject and order for one object size.
+  template <std::size_t Size>
+  void RunSize(Config const & config)
+  {
+    typedef Object<Size> T;
+    for (Order order : { Order::Lifo, Order::Fifo, Order::Random, Order::Churn })
+    {
+      Report(config, Run<NewDelete<T>>(config, "new/delete", Size, order));
+      Report(config, Run<Malloc<T>>(config, "malloc", Size, order));
+      Report(config, Run<PmrPool<T>>(config, "pmr pool", Size, order));
+      Report(config, Run<ObjectPool<T>>(config, "ObjectAllocator", Size, order));
+      Report(config, Run<BitmapObjectPool<T>>(config, "ObjectAllocator (bitmap)", Size, order));
+      Report(config, Run<FixedObjectPool<T>>(config, "ObjectAllocator (fixed)", Size, order));
+      Report(config, Run<SmallObjects<T>>(config, "SmallObjectAllocator", Size, order));
+      Report(config, Run<ManagedPointer<T>>(config, "Pointer", Size, order));
+      Report(config, Run<SharedPointer<T>>(config, "shared_ptr", Size, order));
+      Report(config, Run<UniquePointer<T>>(config, "unique_ptr", Size, order));
+    }
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  Config config;
+  int position = 0;
+  for (int i = 1; i < argc; ++i)
+  {
+    if (std::strcmp(argv[i], "--text") == 0)
+    {
+      config.text = true;
+    }
+    else if (position++ == 0)
+    {
+      config.liveObjects = static_cast<unsigned>(std::strtoul(argv[i], nullptr, 10));
+    }
+    else
+    {
+      config.rounds = static_cast<unsigned>(std::strtoul(argv[i], nullptr, 10));
+    }
+  }
+  if (config.liveObjects == 0)
+  {
+    config.liveObjects = 1;
+  }
+
+  RunSize<16>(config);
+  RunSize<64>(config);
+  RunSize<256>(config);
+  return 0;
+}
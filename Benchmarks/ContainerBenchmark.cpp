@@ -0,0 +1,145 @@
+/*----------------------------------------------------
+ContainerBenchmark.cpp
+
+Compares PoolAllocator and PoolResource with the default
+allocator and std::pmr::unsynchronized_pool_resource on
+node-based containers under insert and erase heavy use.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -I. Benchmarks/ContainerBenchmark.cpp -o ContainerBenchmark
+
+Usage:
+  ContainerBenchmark [live keys] [operations]
+----------------------------------------------------*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <map>
+#include <memory_resource>
+#include <random>
+#include <unordered_map>
+#include <vector>
+#include "../PoolAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Value stored in every container.
+  struct Value
+  {
+    std::uint64_t data[2];
+  };
+
+  // Fills a map-like container with live keys, then erases a random key and inserts a new one
+  // for each operation. Returns nanoseconds per erase/insert pair.
+  template <typename Map>
+  double RunMap(Map & map, std::vector<unsigned> const & keys, unsigned operations)
+  {
+    unsigned live = static_cast<unsigned>(keys.size());
+    std::vector<unsigned> current(keys);
+    for (unsigned key : current)
+    {
+      map.emplace(key, Value{{key, 0}});
+    }
+
+    std::minstd_rand rng(7);
+    unsigned next = live;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < operations; ++i)
+    {
+      unsigned slot = rng() % live;
+      map.erase(current[slot]);
+      current[slot] = next * 2654435761u;
+      ++next;
+      map.emplace(current[slot], Value{{current[slot], i}});
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    map.clear();
+    return std::chrono::duration<double, std::nano>(end - start).count() / operations;
+  }
+
+  // Pushes and pops list nodes at both ends around a steady length. Returns nanoseconds per push/pop pair.
+  template <typename List>
+  double RunList(List & list, unsigned live, unsigned operations)
+  {
+    for (unsigned i = 0; i < live; ++i)
+    {
+      list.push_back(Value{{i, 0}});
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < operations; ++i)
+    {
+      list.pop_front();
+      list.push_back(Value{{i, i}});
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    list.clear();
+    return std::chrono::duration<double, std::nano>(end - start).count() / operations;
+  }
+
+  // Allocator for map nodes.
+  typedef PoolAllocator<std::pair<unsigned const, Value>> MapPoolAllocator;
+
+  // Runs every container through one allocator setup and prints a row.
+  template <typename Map, typename UnorderedMap, typename List>
+  void Report(char const * name, Map & map, UnorderedMap & unorderedMap, List & list, std::vector<unsigned> const & keys, unsigned operations)
+  {
+    double mapTime = RunMap(map, keys, operations);
+    double unorderedTime = RunMap(unorderedMap, keys, operations);
+    double listTime = RunList(list, static_cast<unsigned>(keys.size()), operations);
+    std::printf("%-28s %10.2f %14.2f %10.2f\n", name, mapTime, unorderedTime, listTime);
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned live = argc > 1 ? static_cast<unsigned>(std::strtoul(argv[1], nullptr, 10)) : 100000;
+  unsigned operations = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 2000000;
+
+  std::vector<unsigned> keys(live);
+  std::minstd_rand rng(3);
+  for (unsigned & key : keys)
+  {
+    key = static_cast<unsigned>(rng());
+  }
+
+  std::printf("%u live keys, %u operations (ns per erase/insert pair)\n", live, operations);
+  std::printf("%-28s %10s %14s %10s\n", "allocator", "map", "unordered_map", "list");
+
+  {
+    std::map<unsigned, Value> map;
+    std::unordered_map<unsigned, Value> unorderedMap;
+    std::list<Value> list;
+    Report("std::allocator", map, unorderedMap, list, keys, operations);
+  }
+
+  {
+    PoolSet pools;
+    std::map<unsigned, Value, std::less<unsigned>, MapPoolAllocator> map{MapPoolAllocator(pools)};
+    std::unordered_map<unsigned, Value, std::hash<unsigned>, std::equal_to<unsigned>, MapPoolAllocator> unorderedMap{0, std::hash<unsigned>(), std::equal_to<unsigned>(), MapPoolAllocator(pools)};
+    std::list<Value, PoolAllocator<Value>> list{PoolAllocator<Value>(pools)};
+    Report("PoolAllocator", map, unorderedMap, list, keys, operations);
+  }
+
+  {
+    std::pmr::unsynchronized_pool_resource resource;
+    std::pmr::map<unsigned, Value> map(&resource);
+    std::pmr::unordered_map<unsigned, Value> unorderedMap(&resource);
+    std::pmr::list<Value> list(&resource);
+    Report("unsynchronized_pool_resource", map, unorderedMap, list, keys, operations);
+  }
+
+  {
+    PoolResource<> resource;
+    std::pmr::map<unsigned, Value> map(&resource);
+    std::pmr::unordered_map<unsigned, Value> unorderedMap(&resource);
+    std::pmr::list<Value> list(&resource);
+    Report("PoolResource", map, unorderedMap, list, keys, operations);
+  }
+  return 0;
+}
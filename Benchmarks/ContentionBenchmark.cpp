@@ -0,0 +1,160 @@
+/*----------------------------------------------------
+ContentionBenchmark.cpp
+
+Measures allocation throughput when many threads share one allocator.
+Compares the single-threaded ObjectAllocator path, an ObjectAllocator
+behind a mutex, LockFreeObjectAllocator, ConcurrentObjectAllocator and
+NumaObjectAllocator.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -pthread -I. Benchmarks/ContentionBenchmark.cpp -o ContentionBenchmark -latomic
+
+Usage:
+  ContentionBenchmark [max threads] [operations per thread]
+----------------------------------------------------*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "../ObjectAllocator.h"
+#include "../ConcurrentObjectAllocator.h"
+#include "../LockFreeObjectAllocator.h"
+#include "../NumaObjectAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Object type used by the benchmark.
+  struct Particle
+  {
+    float position[3];
+    float velocity[3];
+    unsigned id;
+
+    Particle(unsigned id) : position(), velocity(), id(id) {}
+  };
+
+  // Number of objects each thread keeps alive before freeing them.
+  const unsigned BatchSize = 64;
+
+  // Allocator wrapped in a mutex, the way callers had to share an ObjectAllocator before.
+  struct LockedObjectAllocator
+  {
+    std::mutex lock;
+    ObjectAllocator<Particle> allocator;
+
+    Particle * Allocate(unsigned id)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      return MM_ALLOC(allocator, Particle(id));
+    }
+
+    void Free(Particle * p)
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      MM_FREE(allocator, p);
+    }
+  };
+
+  // Adapts an allocator with its own synchronization.
+  template <typename Allocator>
+  struct SharedAllocator
+  {
+    Allocator allocator;
+
+    Particle * Allocate(unsigned id)
+    {
+      return MM_ALLOC(allocator, Particle(id));
+    }
+
+    void Free(Particle * p)
+    {
+      MM_FREE(allocator, p);
+    }
+  };
+
+  // Runs the workload on the given number of threads. Returns nanoseconds per allocate/free pair.
+  template <typename Shared>
+  double Run(Shared & shared, unsigned threadCount, unsigned operations)
+  {
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threadCount; ++t)
+    {
+      threads.emplace_back([&shared, operations]()
+      {
+        Particle * live[BatchSize];
+        for (unsigned i = 0; i < operations; i += BatchSize)
+        {
+          for (unsigned j = 0; j < BatchSize; ++j)
+          {
+            live[j] = shared.Allocate(i + j);
+          }
+          for (unsigned j = 0; j < BatchSize; ++j)
+          {
+            shared.Free(live[j]);
+          }
+        }
+      });
+    }
+    for (std::thread & thread : threads)
+    {
+      thread.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(end - start).count();
+    return ns / (double(operations) * threadCount);
+  }
+
+  // Runs the unsynchronized ObjectAllocator on the calling thread as the baseline.
+  double RunSingleThreaded(unsigned operations)
+  {
+    ObjectAllocator<Particle> allocator;
+    Particle * live[BatchSize];
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < operations; i += BatchSize)
+    {
+      for (unsigned j = 0; j < BatchSize; ++j)
+      {
+        live[j] = MM_ALLOC(allocator, Particle(i + j));
+      }
+      for (unsigned j = 0; j < BatchSize; ++j)
+      {
+        MM_FREE(allocator, live[j]);
+      }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / operations;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  unsigned maxThreads = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  unsigned operations = argc > 2 ? std::atoi(argv[2]) : 1 << 20;
+  if (maxThreads == 0)
+  {
+    maxThreads = 1;
+  }
+
+  std::printf("single-threaded ObjectAllocator: %.2f ns/op\n", RunSingleThreaded(operations));
+  std::printf("%8s %12s %12s %12s %12s\n", "threads", "mutex", "lock-free", "magazine", "numa");
+  for (unsigned threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    LockedObjectAllocator locked;
+    SharedAllocator<LockFreeObjectAllocator<Particle>> lockFree;
+    SharedAllocator<ConcurrentObjectAllocator<Particle>> magazine;
+    SharedAllocator<NumaObjectAllocator<Particle>> numa;
+
+    double lockedNs = Run(locked, threads, operations);
+    double lockFreeNs = Run(lockFree, threads, operations);
+    double magazineNs = Run(magazine, threads, operations);
+    double numaNs = Run(numa, threads, operations);
+    std::printf("%8u %9.2f ns %9.2f ns %9.2f ns %9.2f ns\n", threads, lockedNs, lockFreeNs, magazineNs, numaNs);
+  }
+  return 0;
+}
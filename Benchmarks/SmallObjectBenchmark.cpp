@@ -0,0 +1,103 @@
+/*----------------------------------------------------
+SmallObjectBenchmark.cpp
+
+Compares SmallObjectAllocator with the system malloc on a mix of
+small allocations of random sizes, freed in random order.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -I. Benchmarks/SmallObjectBenchmark.cpp -o SmallObjectBenchmark
+
+Usage:
+  SmallObjectBenchmark [max size] [operations]
+----------------------------------------------------*/
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+#include "../SmallObjectAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Number of blocks kept alive at once.
+  const unsigned LiveBlocks = 4096;
+
+  // Allocates through malloc and free.
+  struct SystemMalloc
+  {
+    void * Allocate(std::size_t size) { return std::malloc(size); }
+    void Free(void * mem, std::size_t) { std::free(mem); }
+  };
+
+  // Allocates through a SmallObjectAllocator, freeing with the block size.
+  struct SizedSmallObjects
+  {
+    SmallObjectAllocator<1024> allocator;
+    void * Allocate(std::size_t size) { return MM_SMALLOC(allocator, size); }
+    void Free(void * mem, std::size_t size) { MM_SFREE_SIZED(allocator, mem, size); }
+  };
+
+  // Allocates through a SmallObjectAllocator, freeing without the block size.
+  struct UnsizedSmallObjects
+  {
+    SmallObjectAllocator<1024> allocator;
+    void * Allocate(std::size_t size) { return MM_SMALLOC(allocator, size); }
+    void Free(void * mem, std::size_t) { MM_SFREE(allocator, mem); }
+  };
+
+  // Replaces random live blocks with new ones of random sizes. Returns nanoseconds per allocate/free pair.
+  template <typename Allocator>
+  double Run(Allocator & allocator, std::vector<std::size_t> const & sizes, unsigned operations)
+  {
+    std::vector<void *> blocks(LiveBlocks);
+    std::vector<std::size_t> blockSizes(LiveBlocks);
+    for (unsigned i = 0; i < LiveBlocks; ++i)
+    {
+      blockSizes[i] = sizes[i % sizes.size()];
+      blocks[i] = allocator.Allocate(blockSizes[i]);
+    }
+
+    std::minstd_rand rng(7);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < operations; ++i)
+    {
+      unsigned slot = rng() % LiveBlocks;
+      allocator.Free(blocks[slot], blockSizes[slot]);
+      blockSizes[slot] = sizes[i % sizes.size()];
+      blocks[slot] = allocator.Allocate(blockSizes[slot]);
+      static_cast<unsigned char *>(blocks[slot])[0] = static_cast<unsigned char>(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < LiveBlocks; ++i)
+    {
+      allocator.Free(blocks[i], blockSizes[i]);
+    }
+    return std::chrono::duration<double, std::nano>(end - start).count() / operations;
+  }
+}
+
+int main(int argc, char ** argv)
+{
+  std::size_t maxSize = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 256;
+  unsigned operations = argc > 2 ? static_cast<unsigned>(std::strtoul(argv[2], nullptr, 10)) : 10000000;
+
+  std::vector<std::size_t> sizes(65536);
+  std::minstd_rand rng(3);
+  for (std::size_t & size : sizes)
+  {
+    size = 1 + rng() % maxSize;
+  }
+
+  SystemMalloc system;
+  SizedSmallObjects sized;
+  UnsizedSmallObjects unsized;
+
+  std::printf("sizes 1-%zu, %u operations (ns per allocate/free pair)\n", maxSize, operations);
+  std::printf("%-24s %8.2f\n", "malloc", Run(system, sizes, operations));
+  std::printf("%-24s %8.2f\n", "SmallObject (sized)", Run(sized, sizes, operations));
+  std::printf("%-24s %8.2f\n", "SmallObject (unsized)", Run(unsized, sizes, operations));
+  return 0;
+}
@@ -0,0 +1,168 @@
+/*----------------------------------------------------
+AlignmentCheck.cpp
+
+Checks that every block ObjectAllocator hands out is aligned to its
+type, across several pages, for single objects, batches and arrays,
+with both free tracking modes, a fixed layout and cache-line blocks.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -I. Checks/AlignmentCheck.cpp -o AlignmentCheck
+
+Exits with a non-zero status if a check fails.
+----------------------------------------------------*/
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "../ObjectAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Over-aligned type, such as a SIMD vector.
+  struct alignas(32) Vector
+  {
+    float lanes[8];
+  };
+
+  // Type aligned to a cache line.
+  struct alignas(64) Counter
+  {
+    std::uint64_t value;
+  };
+
+  // Type with an odd size and byte alignment.
+  struct Odd
+  {
+    char bytes[13];
+  };
+
+  // Blocks per page. Small, so the checks cross several pages.
+  const unsigned BlocksPerPage = 16;
+
+  // Number of objects of each kind allocated by a check.
+  const unsigned ObjectCount = BlocksPerPage * 5 + 3;
+
+  // Number of failed checks.
+  unsigned failures = 0;
+
+  // Checks the alignment of a block.
+  void CheckBlock(void const * block, std::size_t alignment, char const * what, char const * type, char const * mode)
+  {
+    if (reinterpret_cast<std::uintptr_t>(block) % alignment != 0)
+    {
+      std::printf("FAILED: %s of %s is not aligned to %zu (%s)\n", what, type, alignment, mode);
+      ++failures;
+    }
+  }
+
+  /*
+    Allocates single objects, a batch and arrays, and checks the alignment of each block.
+    allocator - allocator to check
+    alignment - alignment every block should have
+    type      - name of the object type
+    mode      - name of the allocator settings
+  */
+  template <typename T, typename Layout>
+  void CheckAllocator(ObjectAllocator<T, Layout> & allocator, std::size_t alignment, char const * type, char const * mode)
+  {
+    std::vector<T *> objects;
+    for (unsigned i = 0; i < ObjectCount; ++i)
+    {
+      objects.push_back(MM_ALLOC(allocator, T()));
+      CheckBlock(objects.back(), alignment, "object", type, mode);
+    }
+
+    //Reused blocks come from the free lists
+    for (unsigned i = 0; i < ObjectCount; i += 2)
+    {
+      MM_FREE(allocator, objects[i]);
+    }
+    for (unsigned i = 0; i < ObjectCount; i += 2)
+    {
+      objects[i] = MM_ALLOC(allocator, T());
+      CheckBlock(objects[i], alignment, "reused object", type, mode);
+    }
+
+    std::vector<T *> batch(ObjectCount);
+    MM_ALLOC_BATCH(allocator, ObjectCount, batch.data(), T());
+    for (T * object : batch)
+    {
+      CheckBlock(object, alignment, "batch object", type, mode);
+    }
+
+    //Arrays that fit in a page, and one that falls back to operator new
+    std::vector<T *> arrays;
+    for (unsigned count = 2; count <= BlocksPerPage; count += 3)
+    {
+      arrays.push_back(MM_ALLOC_ARRAY(allocator, count, T()));
+      CheckBlock(arrays.back(), alignment, "array", type, mode);
+    }
+    T * large = MM_ALLOC_ARRAY(allocator, BlocksPerPage * 3, T());
+    CheckBlock(large, alignment, "large array", type, mode);
+
+    MM_FREE_ARRAY(allocator, large, BlocksPerPage * 3);
+    unsigned count = 2;
+    for (T * array : arrays)
+    {
+      MM_FREE_ARRAY(allocator, array, count);
+      count += 3;
+    }
+    MM_FREE_BATCH(allocator, batch.data(), ObjectCount);
+    for (T * object : objects)
+    {
+      MM_FREE(allocator, object);
+    }
+  }
+
+  // Checks an allocator with the given settings.
+  template <typename T, typename Layout = RuntimeLayout>
+  void CheckSettings(ObjectAllocatorSettings settings, std::size_t alignment, char const * type, char const * mode)
+  {
+#ifdef MEMORYMANAGER_DEBUG
+    ObjectAllocator<T, Layout> allocator(static_cast<std::ostream *>(nullptr), settings);
+#else
+    ObjectAllocator<T, Layout> allocator(settings);
+#endif
+    CheckAllocator(allocator, alignment, type, mode);
+  }
+
+  // Checks every mode for a type.
+  template <typename T>
+  void CheckType(char const * type)
+  {
+    //Free lists link blocks with a pointer, so list mode blocks are also pointer aligned
+    std::size_t listAlignment = alignof(T) > alignof(void *) ? alignof(T) : alignof(void *);
+    std::size_t cacheLineAlignment = alignof(T) > MEMORYMANAGER_CACHE_LINE_SIZE ? alignof(T) : MEMORYMANAGER_CACHE_LINE_SIZE;
+
+    ObjectAllocatorSettings settings;
+    settings.blocksPerPage = BlocksPerPage;
+    settings.freeTracking = FreeTracking::List;
+    CheckSettings<T>(settings, listAlignment, type, "list");
+    settings.freeTracking = FreeTracking::Bitmap;
+    CheckSettings<T>(settings, alignof(T), type, "bitmap");
+
+    settings.cacheLineBlocks = true;
+    CheckSettings<T>(settings, cacheLineAlignment, type, "bitmap, cache-line blocks");
+    settings.freeTracking = FreeTracking::List;
+    CheckSettings<T>(settings, cacheLineAlignment, type, "list, cache-line blocks");
+
+    CheckSettings<T, FixedLayout<BlocksPerPage>>(ObjectAllocatorSettings(), listAlignment, type, "fixed layout");
+    CheckSettings<T, FixedLayout<BlocksPerPage, MEMORYMANAGER_CACHE_LINE_SIZE>>(ObjectAllocatorSettings(), cacheLineAlignment, type, "fixed layout, cache-line blocks");
+  }
+}
+
+int main()
+{
+  CheckType<Vector>("32-byte aligned type");
+  CheckType<Counter>("64-byte aligned type");
+  CheckType<Odd>("13-byte type");
+  CheckType<double>("double");
+
+  if (failures != 0)
+  {
+    return 1;
+  }
+  std::printf("All alignment checks passed.\n");
+  return 0;
+}
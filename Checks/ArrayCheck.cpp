@@ -0,0 +1,181 @@
+/*----------------------------------------------------
+ArrayCheck.cpp
+
+Checks that freeing arrays gives their pages back for new arrays, so
+repeated AllocateArray/FreeArray cycles do not keep adding pages.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -I. Checks/ArrayCheck.cpp -o ArrayCheck
+
+Exits with a non-zero status if a check fails.
+----------------------------------------------------*/
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+#include "../ObjectAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Object type used by the checks.
+  struct Sample
+  {
+    int    value;
+    double weight;
+
+    Sample(int value) : value(value), weight(value * 0.5) {}
+  };
+
+  // Counts the pages handed out by the heap page source.
+  class CountingPageSource : public PageSource
+  {
+  public:
+    // Number of pages allocated and not released.
+    unsigned pages = 0;
+
+    virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+    {
+      ++pages;
+      return HeapPageSource::Instance().AllocatePage(size, alignment);
+    }
+
+    virtual void ReleasePage(void * page, std::size_t size, std::size_t alignment)
+    {
+      --pages;
+      HeapPageSource::Instance().ReleasePage(page, size, alignment);
+    }
+  };
+
+  // Number of failed checks.
+  unsigned failures = 0;
+
+  // Reports a failed check.
+  void Check(bool condition, char const * description, FreeTracking tracking)
+  {
+    if (!condition)
+    {
+      std::printf("FAILED: %s (%s)\n", description, tracking == FreeTracking::List ? "list" : "bitmap");
+      ++failures;
+    }
+  }
+
+  // Creates an allocator for the checks.
+  ObjectAllocator<Sample> * CreateAllocator(CountingPageSource & source, FreeTracking tracking)
+  {
+    ObjectAllocatorSettings settings;
+    settings.blocksPerPage = 64;
+    settings.freeTracking = tracking;
+    settings.pageSource = &source;
+#ifdef MEMORYMANAGER_DEBUG
+    return new ObjectAllocator<Sample>(static_cast<std::ostream *>(nullptr), settings);
+#else
+    return new ObjectAllocator<Sample>(settings);
+#endif
+  }
+
+  // Allocates and frees the same array over and over.
+  void CheckRepeatedArrays(FreeTracking tracking)
+  {
+    CountingPageSource source;
+    ObjectAllocator<Sample> * allocator = CreateAllocator(source, tracking);
+    for (int i = 0; i < 1000; ++i)
+    {
+      Sample * array = MM_ALLOC_ARRAY((*allocator), 8, Sample(i));
+      MM_FREE_ARRAY((*allocator), array, 8);
+    }
+    Check(source.pages == 1, "repeated arrays stay on one page", tracking);
+
+    //Single objects use up the never used blocks of the page before the arrays come back
+    std::vector<Sample *> objects;
+    for (int i = 0; i < 64; ++i)
+    {
+      objects.push_back(MM_ALLOC((*allocator), Sample(i)));
+    }
+    for (Sample * object : objects)
+    {
+      MM_FREE((*allocator), object);
+    }
+    for (int i = 0; i < 1000; ++i)
+    {
+      Sample * array = MM_ALLOC_ARRAY((*allocator), 8, Sample(i));
+      MM_FREE_ARRAY((*allocator), array, 8);
+    }
+    Check(source.pages == 1, "arrays reuse a page emptied by single objects", tracking);
+    delete allocator;
+  }
+
+  // Places an array on a page behind a page that has no room for it.
+  void CheckLaterPage(FreeTracking tracking)
+  {
+    CountingPageSource source;
+    ObjectAllocator<Sample> * allocator = CreateAllocator(source, tracking);
+    std::vector<Sample *> objects;
+    for (int i = 0; i < 128; ++i)
+    {
+      objects.push_back(MM_ALLOC((*allocator), Sample(i)));
+    }
+
+    //Empty the second page, then free every other block of the first so it has no run and goes in front
+    for (int i = 64; i < 128; ++i)
+    {
+      MM_FREE((*allocator), objects[i]);
+    }
+    for (int i = 0; i < 64; i += 2)
+    {
+      MM_FREE((*allocator), objects[i]);
+    }
+
+    Sample * array = MM_ALLOC_ARRAY((*allocator), 8, Sample(-1));
+    Check(source.pages == 2, "arrays use any page with room", tracking);
+    MM_FREE_ARRAY((*allocator), array, 8);
+    for (int i = 1; i < 64; i += 2)
+    {
+      MM_FREE((*allocator), objects[i]);
+    }
+    delete allocator;
+  }
+
+#ifdef MEMORYMANAGER_STATS
+  // Counts each array as one allocation, and each of its blocks as in use.
+  void CheckArrayStats(FreeTracking tracking)
+  {
+    CountingPageSource source;
+    ObjectAllocator<Sample> * allocator = CreateAllocator(source, tracking);
+    Sample * object = MM_ALLOC((*allocator), Sample(0));
+    Sample * array = MM_ALLOC_ARRAY((*allocator), 8, Sample(1));
+    Stats stats = allocator->GetStats();
+    Check(stats.allocations == 2, "an array is one allocation", tracking);
+    //The array covers several blocks, fewer in debug builds where it also covers the debug bytes between them
+    std::uint64_t inUse = stats.blocksInUse;
+    Check(inUse > 2, "every block of an array is in use", tracking);
+
+    MM_FREE_ARRAY((*allocator), array, 8);
+    MM_FREE((*allocator), object);
+    stats = allocator->GetStats();
+    Check(stats.deallocations == 2, "an array is one deallocation", tracking);
+    Check(stats.blocksInUse == 0, "no blocks in use after freeing", tracking);
+    Check(stats.mostBlocksInUse == inUse, "most blocks in use counts array blocks", tracking);
+    delete allocator;
+  }
+#endif
+}
+
+int main()
+{
+  for (FreeTracking tracking : { FreeTracking::List, FreeTracking::Bitmap })
+  {
+    CheckRepeatedArrays(tracking);
+    CheckLaterPage(tracking);
+#ifdef MEMORYMANAGER_STATS
+    CheckArrayStats(tracking);
+#endif
+  }
+
+  if (failures != 0)
+  {
+    return 1;
+  }
+  std::printf("All array checks passed.\n");
+  return 0;
+}
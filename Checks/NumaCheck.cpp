@@ -0,0 +1,245 @@
+/*----------------------------------------------------
+NumaCheck.cpp
+
+Checks NumaObjectAllocator on a fake two-node topology, so the per-node
+pools, page binding and the node kept in each page header are exercised
+on single-node machines.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -pthread -I. Checks/NumaCheck.cpp -o NumaCheck
+
+Exits with a non-zero status if a check fails.
+----------------------------------------------------*/
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include <vector>
+#include "../NumaObjectAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Object type used by the checks.
+  struct Sample
+  {
+    int    value;
+    double weight;
+
+    Sample(int value) : value(value), weight(value * 0.5) {}
+  };
+
+  // Number of nodes of the fake topology.
+  const unsigned NodeCount = 2;
+
+  // Number of objects allocated on each node.
+  const int ObjectCount = 1000;
+
+  // Node the calling thread pretends to run on.
+  thread_local unsigned currentNode = 0;
+
+  // Topology with two nodes. Threads choose their node, and binding is recorded instead of done.
+  class FakeTopology : public NumaTopology
+  {
+  public:
+    // Number of pages bound to each node.
+    std::atomic<unsigned> boundPages[NodeCount] = {};
+
+    virtual unsigned GetNodeCount()
+    {
+      return NodeCount;
+    }
+
+    virtual unsigned GetCurrentNode()
+    {
+      return currentNode;
+    }
+
+    virtual void BindMemory(void *, std::size_t, unsigned node)
+    {
+      ++boundPages[node];
+    }
+  };
+
+  // Counts the pages handed out by the heap page source.
+  class CountingPageSource : public PageSource
+  {
+  public:
+    // Number of pages allocated and not released.
+    std::atomic<int> pages{ 0 };
+
+    // Whether a page larger than its alignment was asked for.
+    std::atomic<bool> oversized{ false };
+
+    virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+    {
+      ++pages;
+      if (size > alignment)
+      {
+        oversized = true;
+      }
+      return HeapPageSource::Instance().AllocatePage(size, alignment);
+    }
+
+    virtual void ReleasePage(void * page, std::size_t size, std::size_t alignment)
+    {
+      --pages;
+      HeapPageSource::Instance().ReleasePage(page, size, alignment);
+    }
+  };
+
+  // Number of failed checks.
+  std::atomic<unsigned> failures{ 0 };
+
+  // Reports a failed check.
+  void Check(bool condition, char const * description)
+  {
+    if (!condition)
+    {
+      std::printf("FAILED: %s\n", description);
+      ++failures;
+    }
+  }
+
+  // Allocates on every node from its own thread, then frees the objects from other nodes.
+  void CheckNodes(unsigned blocksPerPage)
+  {
+    FakeTopology topology;
+    CountingPageSource source;
+    {
+      NumaObjectAllocatorSettings settings;
+      settings.topology = &topology;
+      settings.pageSource = &source;
+      settings.blocksPerPage = blocksPerPage;
+
+      //Single block magazines leave no blocks behind in the caches of finished threads, so page counts are exact
+      settings.magazineSize = 1;
+#ifdef MEMORYMANAGER_DEBUG
+      NumaObjectAllocator<Sample> allocator(static_cast<std::ostream *>(nullptr), settings);
+#else
+      NumaObjectAllocator<Sample> allocator(settings);
+#endif
+      Check(allocator.GetNodeCount() == NodeCount, "a pool for every node");
+
+      std::vector<Sample *> objects[NodeCount];
+      std::vector<std::thread> threads;
+      for (unsigned node = 0; node < NodeCount; ++node)
+      {
+        threads.emplace_back([&allocator, &objects, node]()
+        {
+          currentNode = node;
+          for (int i = 0; i < ObjectCount; ++i)
+          {
+            objects[node].push_back(MM_ALLOC(allocator, Sample(i)));
+          }
+        });
+      }
+      for (std::thread & thread : threads)
+      {
+        thread.join();
+      }
+
+      for (unsigned node = 0; node < NodeCount; ++node)
+      {
+        Check(topology.boundPages[node] > 0, "pages are bound to their node");
+        for (int i = 0; i < ObjectCount; ++i)
+        {
+          Check(allocator.GetNode(objects[node][i]) == node, "objects come from the node of the allocating thread");
+          Check(objects[node][i]->value == i, "objects keep their values");
+        }
+      }
+
+      //Free every object from the next node over, then allocate again on each node
+      threads.clear();
+      for (unsigned node = 0; node < NodeCount; ++node)
+      {
+        threads.emplace_back([&allocator, &objects, node]()
+        {
+          currentNode = (node + 1) % NodeCount;
+          for (Sample * object : objects[node])
+          {
+            MM_FREE(allocator, object);
+          }
+          objects[node].clear();
+          allocator.Flush();
+        });
+      }
+      for (std::thread & thread : threads)
+      {
+        thread.join();
+      }
+
+      int pages = source.pages;
+      for (unsigned node = 0; node < NodeCount; ++node)
+      {
+        currentNode = node;
+        for (int i = 0; i < ObjectCount; ++i)
+        {
+          objects[node].push_back(MM_ALLOC(allocator, Sample(i)));
+          Check(allocator.GetNode(objects[node].back()) == node, "objects freed on another node go back to their own node");
+        }
+      }
+      Check(source.pages == pages, "blocks freed on another node are reused by their own node");
+
+      currentNode = 0;
+      for (unsigned node = 0; node < NodeCount; ++node)
+      {
+        for (Sample * object : objects[node])
+        {
+          MM_FREE(allocator, object);
+        }
+      }
+      allocator.Flush();
+    }
+    Check(source.pages == 0, "every page is released");
+    Check(!source.oversized, "pages fit in their alignment");
+  }
+
+  // Topology with a single node.
+  class SingleNodeTopology : public NumaTopology
+  {
+  public:
+    virtual unsigned GetNodeCount()
+    {
+      return 1;
+    }
+
+    virtual unsigned GetCurrentNode()
+    {
+      return 0;
+    }
+  };
+
+  // Checks that a single node topology keeps one pool.
+  void CheckSingleNode()
+  {
+    SingleNodeTopology topology;
+    NumaObjectAllocatorSettings settings;
+    settings.topology = &topology;
+#ifdef MEMORYMANAGER_DEBUG
+    NumaObjectAllocator<Sample> allocator(static_cast<std::ostream *>(nullptr), settings);
+#else
+    NumaObjectAllocator<Sample> allocator(settings);
+#endif
+    Check(allocator.GetNodeCount() == 1, "one pool on a single node");
+    Sample * object = MM_ALLOC(allocator, Sample(1));
+    Check(allocator.GetNode(object) == 0, "single node objects are on node 0");
+    MM_FREE(allocator, object);
+  }
+}
+
+int main()
+{
+  for (unsigned blocksPerPage : { 1u, 64u, 1024u })
+  {
+    CheckNodes(blocksPerPage);
+  }
+  CheckSingleNode();
+
+  if (failures != 0)
+  {
+    return 1;
+  }
+  std::printf("All NUMA checks passed.\n");
+  return 0;
+}
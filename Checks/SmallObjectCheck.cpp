@@ -0,0 +1,123 @@
+/*----------------------------------------------------
+SmallObjectCheck.cpp
+
+Checks that every size class of SmallObjectAllocator fills its pages,
+so no size class leaves a large part of each page unused.
+
+Build from the repository root:
+  g++ -std=c++17 -O2 -I. Checks/SmallObjectCheck.cpp -o SmallObjectCheck
+
+Exits with a non-zero status if a check fails.
+----------------------------------------------------*/
+#include <cstdio>
+#include <vector>
+#include "../SmallObjectAllocator.h"
+
+using namespace MemoryManager;
+
+namespace
+{
+  // Largest size served by the pools.
+  const std::size_t MaxSize = 256;
+
+  // Least part of a default page the blocks of a size class should take.
+  const double MinFillRatio = 0.98;
+
+  // Counts the pages handed out by the heap page source.
+  class CountingPageSource : public PageSource
+  {
+  public:
+    // Number of pages allocated and not released.
+    unsigned pages = 0;
+
+    virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+    {
+      ++pages;
+      return HeapPageSource::Instance().AllocatePage(size, alignment);
+    }
+
+    virtual void ReleasePage(void * page, std::size_t size, std::size_t alignment)
+    {
+      --pages;
+      HeapPageSource::Instance().ReleasePage(page, size, alignment);
+    }
+  };
+
+  // Number of failed checks.
+  unsigned failures = 0;
+
+  // Reports a failed check.
+  void Check(bool condition, char const * description, std::size_t size, std::size_t pageSize)
+  {
+    if (!condition)
+    {
+      std::printf("FAILED: %s (%zu byte blocks, %zu byte pages)\n", description, size, pageSize);
+      ++failures;
+    }
+  }
+
+  // Gets the geometry of a page of a size class holding the given number of blocks.
+  PageGeometry GetGeometry(std::size_t size, unsigned blocks, unsigned padBytes)
+  {
+#ifdef MEMORYMANAGER_DEBUG
+    unsigned headerSize = sizeof(DebugHeader);
+#else
+    unsigned headerSize = 0;
+#endif
+    return PageGeometry(size, SmallObjectGranularity, headerSize, blocks, SmallObjectGranularity, padBytes, FreeTracking::List);
+  }
+
+  /*
+    Fills the first page of every size class and checks how much of it the blocks take.
+    pageSize     - size of each page
+    minFillRatio - least part of each page the blocks should take
+  */
+  void CheckPages(std::size_t pageSize, double minFillRatio)
+  {
+    CountingPageSource source;
+    SmallObjectAllocatorSettings settings;
+    settings.pageSize = pageSize;
+    settings.pageSource = &source;
+#ifdef MEMORYMANAGER_DEBUG
+    SmallObjectAllocator<MaxSize> allocator(nullptr, settings);
+#else
+    SmallObjectAllocator<MaxSize> allocator(settings);
+#endif
+
+    for (std::size_t size = SmallObjectGranularity; size <= MaxSize; size += SmallObjectGranularity)
+    {
+      //Allocate until the size class asks for a second page
+      std::vector<void *> blocks;
+      unsigned pages = source.pages;
+      while (source.pages <= pages + 1)
+      {
+        blocks.push_back(MM_SMALLOC(allocator, size));
+      }
+      unsigned blocksPerPage = static_cast<unsigned>(blocks.size() - 1);
+
+      PageGeometry filled = GetGeometry(size, blocksPerPage, settings.padBytes);
+      PageGeometry over = GetGeometry(size, blocksPerPage + 1, settings.padBytes);
+      Check(filled.pageSize <= pageSize, "the blocks fit in the page", size, pageSize);
+      Check(over.pageSize > pageSize, "no other block fits in the page", size, pageSize);
+      Check(blocksPerPage * filled.blockStride >= minFillRatio * pageSize, "the blocks fill the page", size, pageSize);
+
+      for (void * block : blocks)
+      {
+        MM_SFREE(allocator, block);
+      }
+    }
+  }
+}
+
+int main()
+{
+  CheckPages(SmallObjectAllocatorSettings().pageSize, MinFillRatio);
+  CheckPages(4096, 0.0);
+
+  if (failures != 0)
+  {
+    return 1;
+  }
+  std::printf("All small object checks passed.\n");
+  return 0;
+}
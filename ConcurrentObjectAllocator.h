@@ -0,0 +1,435 @@
+/*----------------------------------------------------
+ConcurrentObjectAllocator.h
+
+Thread-safe object allocator with per-thread magazine caches.
+----------------------------------------------------*/
+#ifndef ConcurrentObjectAllocator_h
+#define ConcurrentObjectAllocator_h
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include "ObjectAllocator.h"
+#include "ThreadIndex.h"
+
+namespace MemoryManager
+{
+  // Settings for ConcurrentObjectAllocator
+  struct ConcurrentObjectAllocatorSettings : ObjectAllocatorSettings
+  {
+    // Number of blocks in a magazine. Blocks move between threads and the central free list a magazine at a time.
+    unsigned  magazineSize = 32;
+  };
+
+  /*
+    Thread-safe object allocator. Each thread keeps two magazines of free blocks, so Allocate and Free
+    only touch thread-local data on the fast path. Full magazines are exchanged with a central depot,
+    and new magazines are filled from a central ObjectAllocator. Both are guarded by a single lock which
+    is taken once per magazine rather than once per block. When a thread exits, its magazines are
+    returned to the central free list, so their blocks and pages are not stranded.
+  */
+  template <typename T>
+  class ConcurrentObjectAllocator : private ThreadCacheOwner
+  {
+    // A chain of free blocks.
+    struct Magazine
+    {
+      // Blocks in the magazine.
+      GenericObject * blocks = nullptr;
+
+      // Number of blocks in the magazine.
+      unsigned        count = 0;
+    };
+
+    // Blocks cached by a single thread.
+    struct alignas(MEMORYMANAGER_CACHE_LINE_SIZE) ThreadCache
+    {
+      // Magazine blocks are allocated from and freed to.
+      Magazine                loaded;
+
+      // Either empty or full. Swapped with the loaded magazine before going to the depot.
+      Magazine                previous;
+#ifdef MEMORYMANAGER_STATS
+      // Number of allocations made by the thread. Only written by the owning thread.
+      std::atomic<std::uint64_t> allocations{ 0 };
+
+      // Number of frees made by the thread. Only written by the owning thread.
+      std::atomic<std::uint64_t> deallocations{ 0 };
+#endif
+    };
+
+    // Prevent copy and assignment.
+    ConcurrentObjectAllocator(ConcurrentObjectAllocator const & rhs) = delete;
+    ConcurrentObjectAllocator & operator=(ConcurrentObjectAllocator const & rhs) = delete;
+
+    // Number of blocks in a full magazine.
+    unsigned                      magazineSize;
+
+    // Guards the central allocator and the depot.
+    mutable std::mutex            centralLock;
+
+    // Central free list. Creates pages and fills new magazines.
+    ObjectAllocator<T>            central;
+
+    // Full magazines returned by threads.
+    std::vector<GenericObject *>  depot;
+
+    // Caches for each thread index.
+    ThreadCache                   caches[MEMORYMANAGER_MAX_THREADS];
+
+  public:
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logStream - The log stream to use
+      settings  - settings for the allocator
+    */
+    ConcurrentObjectAllocator(std::ostream * logStream = nullptr, ConcurrentObjectAllocatorSettings settings = ConcurrentObjectAllocatorSettings());
+
+    /*
+      Constructor.
+      logFile - The log file to open. The allocator will manage this output stream.
+      settings  - settings for the allocator
+    */
+    ConcurrentObjectAllocator(char const * logFile, ConcurrentObjectAllocatorSettings settings = ConcurrentObjectAllocatorSettings());
+#else
+    ConcurrentObjectAllocator(ConcurrentObjectAllocatorSettings settings = ConcurrentObjectAllocatorSettings());
+#endif
+
+    // Destructor.
+    ~ConcurrentObjectAllocator();
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Dumps all memory in use to the output stream.
+      outputStream - output stream to dump to.
+    */
+    void DumpMemoryInUse(std::ostream & outputStream) const;
+
+    // Get the log stream for the allocator.
+    std::ostream & GetLogStream() { return central.GetLogStream(); }
+
+    // Get the debug header for the given block. This does not check the validity of the block.
+    DebugHeader const * GetDebugHeader(void const * mem) const { return central.GetDebugHeader(mem); }
+
+    /*
+      Allocates and returns a block.
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    void * Allocate(const char * file, unsigned line);
+
+    /*
+      Frees an allocated block. Checks the validity of the free and returns an error code
+      or throws if the free is invalid. Validation takes the central lock.
+      mem  - the block to free.
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    unsigned char Free(void * mem, char const * file, unsigned line);
+#else
+    void * Allocate();
+    void Free(void * mem);
+#endif
+
+    // Returns the blocks cached by the calling thread to the central free list. Done for every thread when it exits.
+    void Flush();
+
+#ifdef MEMORYMANAGER_STATS
+    /*
+      Get allocator statistics. Each thread counts its own allocations, and the counts are summed here.
+      Blocks cached by threads are counted as free blocks. The most blocks in use is tracked at
+      magazine granularity.
+    */
+    Stats GetStats() const;
+#endif
+
+  private:
+    // Gets the cache of the calling thread, or null if the thread has no cache.
+    ThreadCache * GetThreadCache();
+
+    // Loads a magazine with blocks when the loaded magazine is empty.
+    void Reload(ThreadCache & cache);
+
+    // Makes room in the loaded magazine when it is full.
+    void Unload(ThreadCache & cache);
+
+    // Returns the blocks of a cache to the central free list.
+    void FlushCache(ThreadCache & cache);
+
+    // Returns the blocks cached by an exiting thread.
+    virtual void FlushThread(unsigned index);
+  };
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  ConcurrentObjectAllocator<T>::ConcurrentObjectAllocator(char const * logFile, ConcurrentObjectAllocatorSettings settings) :
+    magazineSize(settings.magazineSize > 0 ? settings.magazineSize : 1),
+    central(logFile, WithFreeList(settings))
+  {
+    RegisterThreadExit();
+  }
+
+  template <typename T>
+  ConcurrentObjectAllocator<T>::ConcurrentObjectAllocator(std::ostream * logStream, ConcurrentObjectAllocatorSettings settings) :
+    magazineSize(settings.magazineSize > 0 ? settings.magazineSize : 1),
+    central(logStream, WithFreeList(settings))
+  {
+    RegisterThreadExit();
+  }
+#else
+  template <typename T>
+  ConcurrentObjectAllocator<T>::ConcurrentObjectAllocator(ConcurrentObjectAllocatorSettings settings) :
+    magazineSize(settings.magazineSize > 0 ? settings.magazineSize : 1),
+    central(WithFreeList(settings))
+  {
+    RegisterThreadExit();
+  }
+#endif
+
+  template <typename T>
+  ConcurrentObjectAllocator<T>::~ConcurrentObjectAllocator()
+  {
+    UnregisterThreadExit();
+  }
+
+  template <typename T>
+  typename ConcurrentObjectAllocator<T>::ThreadCache * ConcurrentObjectAllocator<T>::GetThreadCache()
+  {
+    unsigned index = ThreadIndex::Current();
+    return index < MEMORYMANAGER_MAX_THREADS ? &caches[index] : nullptr;
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  void * ConcurrentObjectAllocator<T>::Allocate(const char * file, unsigned line)
+  {
+    ThreadCache * cache = GetThreadCache();
+    if (cache == nullptr)
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      return central.Allocate(file, line);
+    }
+
+    if (cache->loaded.count == 0)
+    {
+      Reload(*cache);
+    }
+
+    char * p = reinterpret_cast<char*>(Pop(cache->loaded.blocks));
+    --cache->loaded.count;
+    cache->allocations.store(cache->allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    central.PrepareBlock(p, file, line);
+    return p;
+  }
+
+  template <typename T>
+  unsigned char ConcurrentObjectAllocator<T>::Free(void * mem, char const * file, unsigned line)
+  {
+    ThreadCache * cache = GetThreadCache();
+    if (cache == nullptr)
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      return central.Free(mem, file, line);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      unsigned char errorCode = central.ValidateFree(mem, file, line);
+      if (errorCode != 0)
+      {
+        return errorCode;
+      }
+    }
+
+    static_cast<T *>(mem)->~T();
+    central.ClearBlock(mem);
+
+    if (cache->loaded.count == magazineSize)
+    {
+      Unload(*cache);
+    }
+
+    Push(cache->loaded.blocks, reinterpret_cast<GenericObject*>(mem));
+    ++cache->loaded.count;
+    cache->deallocations.store(cache->deallocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    return 0;
+  }
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::DumpMemoryInUse(std::ostream & outputStream) const
+  {
+    std::lock_guard<std::mutex> lock(centralLock);
+    central.DumpMemoryInUse(outputStream);
+  }
+#else
+  template <typename T>
+  void * ConcurrentObjectAllocator<T>::Allocate()
+  {
+    ThreadCache * cache = GetThreadCache();
+    if (cache == nullptr)
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      return central.Allocate();
+    }
+
+    if (cache->loaded.count == 0)
+    {
+      Reload(*cache);
+    }
+
+    --cache->loaded.count;
+#ifdef MEMORYMANAGER_STATS
+    cache->allocations.store(cache->allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+    return Pop(cache->loaded.blocks);
+  }
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::Free(void * mem)
+  {
+    if (mem == nullptr)
+    {
+      return;
+    }
+
+    ThreadCache * cache = GetThreadCache();
+    if (cache == nullptr)
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      central.Free(mem);
+      return;
+    }
+
+    static_cast<T *>(mem)->~T();
+
+    if (cache->loaded.count == magazineSize)
+    {
+      Unload(*cache);
+    }
+
+    Push(cache->loaded.blocks, reinterpret_cast<GenericObject*>(mem));
+    ++cache->loaded.count;
+#ifdef MEMORYMANAGER_STATS
+    cache->deallocations.store(cache->deallocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+#endif
+  }
+#endif
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::Reload(ThreadCache & cache)
+  {
+    //Previous magazine is full, use it
+    if (cache.previous.count > 0)
+    {
+      std::swap(cache.loaded, cache.previous);
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(centralLock);
+    if (!depot.empty())
+    {
+      cache.loaded.blocks = depot.back();
+      depot.pop_back();
+    }
+    else
+    {
+      GenericObject * tail;
+      cache.loaded.blocks = central.AcquireBlocks(magazineSize, tail);
+    }
+    cache.loaded.count = magazineSize;
+  }
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::Unload(ThreadCache & cache)
+  {
+    //Previous magazine is empty, free into it
+    if (cache.previous.count == 0)
+    {
+      std::swap(cache.loaded, cache.previous);
+      return;
+    }
+
+    //Both magazines are full. Send the previous one to the depot
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      depot.push_back(cache.previous.blocks);
+    }
+    cache.previous = cache.loaded;
+    cache.loaded = Magazine();
+  }
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::Flush()
+  {
+    ThreadCache * cache = GetThreadCache();
+    if (cache != nullptr)
+    {
+      FlushCache(*cache);
+    }
+  }
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::FlushThread(unsigned index)
+  {
+    FlushCache(caches[index]);
+  }
+
+  template <typename T>
+  void ConcurrentObjectAllocator<T>::FlushCache(ThreadCache & cache)
+  {
+    if (cache.loaded.count == 0 && cache.previous.count == 0)
+    {
+      return;
+    }
+
+    std::lock_guard<std::mutex> lock(centralLock);
+    for (Magazine * magazine : { &cache.loaded, &cache.previous })
+    {
+      if (magazine->count > 0)
+      {
+        //Find the end of the chain
+        GenericObject * tail = magazine->blocks;
+        while (tail->next != nullptr)
+        {
+          tail = tail->next;
+        }
+        central.ReleaseBlocks(magazine->blocks, tail, magazine->count);
+        *magazine = Magazine();
+      }
+    }
+  }
+
+#ifdef MEMORYMANAGER_STATS
+  template <typename T>
+  Stats ConcurrentObjectAllocator<T>::GetStats() const
+  {
+    Stats stats;
+    std::uint64_t cachedAllocations = 0;
+    std::uint64_t cachedDeallocations = 0;
+    {
+      std::lock_guard<std::mutex> lock(centralLock);
+      stats = central.GetStats();
+    }
+
+    for (ThreadCache const & cache : caches)
+    {
+      cachedAllocations += cache.allocations.load(std::memory_order_relaxed);
+      cachedDeallocations += cache.deallocations.load(std::memory_order_relaxed);
+    }
+
+    //Blocks handed to magazines are in use as far as the central allocator is concerned
+    std::uint64_t cachedInUse = cachedAllocations - cachedDeallocations;
+    std::uint64_t handedOut = stats.blocksInUse - (stats.allocations - stats.deallocations);
+    stats.freeBlocks += handedOut - cachedInUse;
+    stats.blocksInUse -= handedOut - cachedInUse;
+    stats.allocations += cachedAllocations;
+    stats.deallocations += cachedDeallocations;
+    return stats;
+  }
+#endif
+}
+
+#endif // ConcurrentObjectAllocator_h
@@ -0,0 +1,234 @@
+/*----------------------------------------------------
+GenerationalHandle.h
+
+Generational index handles and the allocator that resolves them.
+----------------------------------------------------*/
+#ifndef GenerationalHandle_h
+#define GenerationalHandle_h
+
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+#include "ObjectAllocator.h"
+
+namespace MemoryManager
+{
+  /*
+    Handle to an object in a GenerationalAllocator. Made of a slot index and the generation of the
+    slot when the object was allocated. Freeing the object bumps the generation of the slot, so stale
+    handles are detected with one compare, in any build. There is no reference counting.
+    A default constructed handle is null.
+  */
+  template <typename T>
+  struct GenerationalHandle
+  {
+    // Index of the slot in the allocator's slot table.
+    std::uint32_t index = 0;
+
+    // Generation of the slot the handle refers to.
+    std::uint32_t generation = 0;
+
+    // Checks whether the handle is null. A non-null handle may still be stale.
+    inline bool IsNull() const
+    {
+      return generation == 0;
+    }
+
+    // Equality operator.
+    inline bool operator==(GenerationalHandle const & rhs) const
+    {
+      return index == rhs.index && generation == rhs.generation;
+    }
+
+    // Inequality operator.
+    inline bool operator!=(GenerationalHandle const & rhs) const
+    {
+      return !(*this == rhs);
+    }
+  };
+
+  static_assert(sizeof(GenerationalHandle<void>) == 8, "GenerationalHandle should be 8 bytes.");
+  static_assert(std::is_trivially_copyable<GenerationalHandle<void>>::value, "GenerationalHandle should be trivially copyable.");
+
+  /*
+    Allocator that hands out GenerationalHandles instead of pointers. Objects come from an
+    ObjectAllocator, and handles are resolved through a slot table owned by this allocator.
+  */
+  template <typename T>
+  class GenerationalAllocator
+  {
+    // Entry of the slot table.
+    struct Slot
+    {
+      // Object stored in the slot, or null if the slot is free.
+      T *           memory;
+
+      // Current generation of the slot. Never 0 for slots that hold an object.
+      std::uint32_t generation;
+
+      // Next free slot, if this slot is free.
+      std::uint32_t nextFree;
+    };
+
+    // Marks the end of the free slot list.
+    static const std::uint32_t NoSlot = 0xFFFFFFFFu;
+
+    // Prevent copy and assignment.
+    GenerationalAllocator(GenerationalAllocator const & rhs) = delete;
+    GenerationalAllocator & operator=(GenerationalAllocator const & rhs) = delete;
+
+    // Allocator for the objects.
+    ObjectAllocator<T>  allocator;
+
+    // Slot table. Slot 0 is reserved so that null handles resolve to null.
+    std::vector<Slot>   slots;
+
+    // First free slot.
+    std::uint32_t       freeSlots;
+
+#ifdef MEMORYMANAGER_DEBUG
+    // Output stream to send logging information.
+    std::ostream *      logStream;
+#endif
+
+  public:
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logStream - The log stream to use
+      settings  - settings for the object allocator
+    */
+    GenerationalAllocator(std::ostream * logStream = nullptr, ObjectAllocatorSettings settings = ObjectAllocatorSettings()) :
+      allocator(logStream, settings),
+      slots(1, Slot{ nullptr, 0, NoSlot }),
+      freeSlots(NoSlot),
+      logStream(logStream)
+    {
+    }
+#else
+    GenerationalAllocator(ObjectAllocatorSettings settings = ObjectAllocatorSettings()) :
+      allocator(settings),
+      slots(1, Slot{ nullptr, 0, NoSlot }),
+      freeSlots(NoSlot)
+    {
+    }
+#endif
+
+    // Gets the allocator for the objects.
+    ObjectAllocator<T> & GetObjectAllocator() { return allocator; }
+
+    /*
+      Creates a handle for an object allocated from GetObjectAllocator().
+      memory - the object
+    */
+    GenerationalHandle<T> CreateHandle(T * memory);
+
+    // Gets the object referenced by a handle, or null if the handle is null, stale or not from this allocator.
+    inline T * Get(GenerationalHandle<T> handle) const
+    {
+      if (handle.index >= slots.size())
+      {
+        return nullptr;
+      }
+      Slot const & slot = slots[handle.index];
+      return slot.generation == handle.generation ? slot.memory : nullptr;
+    }
+
+    // Checks whether a handle refers to a live object of this allocator.
+    inline bool IsValid(GenerationalHandle<T> handle) const
+    {
+      return !handle.IsNull() && handle.index < slots.size() && slots[handle.index].generation == handle.generation;
+    }
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Frees the object referenced by a handle and invalidates all copies of the handle.
+      Returns false and logs (or throws) if the handle is null or stale, or if the object allocator
+      finds the free invalid. The slot is left as it was when false is returned.
+      file - the file where the memory was freed.
+      line - the line where the memory was freed.
+    */
+    bool Free(GenerationalHandle<T> handle, char const * file, unsigned line);
+#else
+    bool Free(GenerationalHandle<T> handle);
+#endif
+  };
+
+  template <typename T>
+  GenerationalHandle<T> GenerationalAllocator<T>::CreateHandle(T * memory)
+  {
+    std::uint32_t index = freeSlots;
+    if (index != NoSlot)
+    {
+      freeSlots = slots[index].nextFree;
+    }
+    else
+    {
+      index = static_cast<std::uint32_t>(slots.size());
+      slots.push_back(Slot{ nullptr, 1, NoSlot });
+    }
+
+    Slot & slot = slots[index];
+    slot.memory = memory;
+
+    GenerationalHandle<T> handle;
+    handle.index = index;
+    handle.generation = slot.generation;
+    return handle;
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  bool GenerationalAllocator<T>::Free(GenerationalHandle<T> handle, char const * file, unsigned line)
+  {
+    if (!IsValid(handle))
+    {
+      //Dangling handle free
+      if (logStream != nullptr)
+      {
+        *logStream << "[GenerationalAllocator]: Attempt to free stale or null handle at: " << file << " #" << line << std::endl;
+      }
+#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
+      throw MemoryManagerException("Attempt to free stale or null handle.", file, line);
+#endif
+      return false;
+    }
+
+    Slot & slot = slots[handle.index];
+    if (allocator.Free(slot.memory, file, line) != 0)
+    {
+      return false;
+    }
+#else
+  template <typename T>
+  bool GenerationalAllocator<T>::Free(GenerationalHandle<T> handle)
+  {
+    if (!IsValid(handle))
+    {
+      return false;
+    }
+
+    Slot & slot = slots[handle.index];
+    allocator.Free(slot.memory);
+#endif
+
+    //Invalidate outstanding handles and return the slot to the free list
+    slot.memory = nullptr;
+    if (++slot.generation == 0)
+    {
+      slot.generation = 1;
+    }
+    slot.nextFree = freeSlots;
+    freeSlots = handle.index;
+    return true;
+  }
+}
+
+#define MM_GALLOC(allocator, constructor) (allocator).CreateHandle(MM_ALLOC((allocator).GetObjectAllocator(), constructor))
+#ifdef MEMORYMANAGER_DEBUG
+#define MM_GFREE(allocator, handle) (allocator).Free(handle, __FILE__, __LINE__)
+#else
+#define MM_GFREE(allocator, handle) (allocator).Free(handle)
+#endif
+
+#endif // GenerationalHandle_h
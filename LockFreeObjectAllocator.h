@@ -0,0 +1,319 @@
+/*----------------------------------------------------
+LockFreeObjectAllocator.h
+
+Object allocator shared between threads through a lock-free free list.
+----------------------------------------------------*/
+#ifndef LockFreeObjectAllocator_h
+#define LockFreeObjectAllocator_h
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include "ObjectAllocator.h"
+#include "ThreadIndex.h"
+
+namespace MemoryManager
+{
+  /*
+    Lock-free stack of GenericObjects (Treiber stack). The head pointer sits next to a tag that
+    changes on every update, and both are swapped together with a double-word compare-and-swap
+    (cmpxchg16b on x86-64), so a Pop that raced with other threads popping and pushing back the
+    same block fails its swap instead of corrupting the list (the ABA problem).
+    The tag is a full word, so the pointer keeps every bit. ABA is still possible if a thread is
+    preempted inside Pop, between reading the next pointer and its swap, while other threads make
+    a whole multiple of 2^64 updates (2^32 on 32-bit targets) and leave the same block on top.
+    On 64-bit targets that takes centuries. On 32-bit targets it takes a preemption of seconds
+    under heavy contention, which is unlikely but not impossible.
+    Blocks are never returned to the system while on the list, so reading the next pointer of a block
+    that was popped by another thread is safe; the value is discarded when the swap fails.
+    Compilers without an inline double-word swap call libatomic, so link with -latomic.
+  */
+  class AtomicFreeList
+  {
+    // Head pointer and tag, swapped together.
+    struct alignas(2 * sizeof(void*)) Head
+    {
+      // Top of the stack.
+      GenericObject * top;
+
+      // Number of updates of the head.
+      std::uintptr_t  tag;
+    };
+
+    static_assert(sizeof(Head) == 2 * sizeof(void*), "The head should be two words, for a double-word compare-and-swap.");
+
+    // Head pointer and tag.
+    std::atomic<Head> head;
+
+    // Makes a new head from a pointer, with the tag following the one in the previous head.
+    static inline Head Pack(GenericObject * obj, Head previous)
+    {
+      return Head{ obj, previous.tag + 1 };
+    }
+
+  public:
+    // Constructor.
+    AtomicFreeList() : head(Head{ nullptr, 0 }) {}
+
+    // Pushes a GenericObject onto the stack.
+    inline void Push(GenericObject * obj)
+    {
+      PushChain(obj, obj);
+    }
+
+    // Pushes a chain of GenericObjects linked from first to last onto the stack with a single swap.
+    inline void PushChain(GenericObject * first, GenericObject * last)
+    {
+      Head old = head.load(std::memory_order_relaxed);
+      do
+      {
+        last->next = old.top;
+      } while (!head.compare_exchange_weak(old, Pack(first, old), std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    // Pops a GenericObject off the stack. Returns null if the stack is empty.
+    inline GenericObject * Pop()
+    {
+      Head old = head.load(std::memory_order_acquire);
+      for (;;)
+      {
+        GenericObject * top = old.top;
+        if (top == nullptr)
+        {
+          return nullptr;
+        }
+
+        if (head.compare_exchange_weak(old, Pack(top->next, old), std::memory_order_acquire, std::memory_order_acquire))
+        {
+          return top;
+        }
+      }
+    }
+
+    // Removes every GenericObject from the stack and returns them as a chain.
+    inline GenericObject * PopAll()
+    {
+      Head old = head.load(std::memory_order_relaxed);
+      while (!head.compare_exchange_weak(old, Pack(nullptr, old), std::memory_order_acquire, std::memory_order_relaxed))
+      {
+      }
+      return old.top;
+    }
+  };
+
+  /*
+    Object allocator that can be shared between threads. Allocate and Free are a single
+    compare-and-swap on a lock-free free list. When the list runs dry, a new page is created under
+    a lock and all of its blocks are spliced onto the list at once.
+  */
+  template <typename T>
+  class LockFreeObjectAllocator
+  {
+    // Prevent copy and assignment.
+    LockFreeObjectAllocator(LockFreeObjectAllocator const & rhs) = delete;
+    LockFreeObjectAllocator & operator=(LockFreeObjectAllocator const & rhs) = delete;
+
+    // Shared free list.
+    AtomicFreeList          freeList;
+
+    // Guards the page allocator. Only taken when creating pages.
+    mutable std::mutex      pageLock;
+
+    // Creates and owns the pages.
+    ObjectAllocator<T>      pages;
+
+#ifdef MEMORYMANAGER_STATS
+    // Indices of the counters.
+    enum Counter { Allocations, Deallocations, CounterCount };
+
+    // Allocations and deallocations made by each thread.
+    ThreadCounters<CounterCount> counters;
+#endif
+
+  public:
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logStream - The log stream to use
+      settings  - settings for the allocator
+    */
+    LockFreeObjectAllocator(std::ostream * logStream = nullptr, ObjectAllocatorSettings settings = ObjectAllocatorSettings());
+
+    /*
+      Constructor.
+      logFile - The log file to open. The allocator will manage this output stream.
+      settings  - settings for the allocator
+    */
+    LockFreeObjectAllocator(char const * logFile, ObjectAllocatorSettings settings = ObjectAllocatorSettings());
+
+    /*
+      Dumps all memory in use to the output stream.
+      outputStream - output stream to dump to.
+    */
+    void DumpMemoryInUse(std::ostream & outputStream) const;
+
+    // Get the log stream for the allocator.
+    std::ostream & GetLogStream() { return pages.GetLogStream(); }
+
+    // Get the debug header for the given block. This does not check the validity of the block.
+    DebugHeader const * GetDebugHeader(void const * mem) const { return pages.GetDebugHeader(mem); }
+
+    /*
+      Allocates and returns a block.
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    void * Allocate(const char * file, unsigned line);
+
+    /*
+      Frees an allocated block. Checks the validity of the free and returns an error code
+      or throws if the free is invalid. Validation takes the page lock.
+      mem  - the block to free.
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    unsigned char Free(void * mem, char const * file, unsigned line);
+#else
+    LockFreeObjectAllocator(ObjectAllocatorSettings settings = ObjectAllocatorSettings());
+    void * Allocate();
+    void Free(void * mem);
+#endif
+
+#ifdef MEMORYMANAGER_STATS
+    /*
+      Get allocator statistics. Each thread counts its own allocations, and the counts are summed here.
+      The most blocks in use is only sampled when statistics are read.
+    */
+    Stats GetStats() const;
+#endif
+
+  private:
+    // Pops a block off the free list, creating a page if the list is empty.
+    GenericObject * PopBlock();
+  };
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  LockFreeObjectAllocator<T>::LockFreeObjectAllocator(char const * logFile, ObjectAllocatorSettings settings) :
+    pages(logFile, WithFreeList(settings))
+  {
+  }
+
+  template <typename T>
+  LockFreeObjectAllocator<T>::LockFreeObjectAllocator(std::ostream * logStream, ObjectAllocatorSettings settings) :
+    pages(logStream, WithFreeList(settings))
+  {
+  }
+
+  template <typename T>
+  void * LockFreeObjectAllocator<T>::Allocate(const char * file, unsigned line)
+  {
+    char * p = reinterpret_cast<char*>(PopBlock());
+    pages.PrepareBlock(p, file, line);
+    counters.Add(Allocations, 1);
+    return p;
+  }
+
+  template <typename T>
+  unsigned char LockFreeObjectAllocator<T>::Free(void * mem, char const * file, unsigned line)
+  {
+    {
+      std::lock_guard<std::mutex> lock(pageLock);
+      unsigned char errorCode = pages.ValidateFree(mem, file, line);
+      if (errorCode != 0)
+      {
+        return errorCode;
+      }
+    }
+
+    static_cast<T *>(mem)->~T();
+    pages.ClearBlock(mem);
+    freeList.Push(reinterpret_cast<GenericObject*>(mem));
+    counters.Add(Deallocations, 1);
+    return 0;
+  }
+
+  template <typename T>
+  void LockFreeObjectAllocator<T>::DumpMemoryInUse(std::ostream & outputStream) const
+  {
+    std::lock_guard<std::mutex> lock(pageLock);
+    pages.DumpMemoryInUse(outputStream);
+  }
+#else
+  template <typename T>
+  LockFreeObjectAllocator<T>::LockFreeObjectAllocator(ObjectAllocatorSettings settings) :
+    pages(WithFreeList(settings))
+  {
+  }
+
+  template <typename T>
+  void * LockFreeObjectAllocator<T>::Allocate()
+  {
+#ifdef MEMORYMANAGER_STATS
+    counters.Add(Allocations, 1);
+#endif
+    return PopBlock();
+  }
+
+  template <typename T>
+  void LockFreeObjectAllocator<T>::Free(void * mem)
+  {
+    if (mem != nullptr)
+    {
+      static_cast<T *>(mem)->~T();
+      freeList.Push(reinterpret_cast<GenericObject*>(mem));
+#ifdef MEMORYMANAGER_STATS
+      counters.Add(Deallocations, 1);
+#endif
+    }
+  }
+#endif
+
+#ifdef MEMORYMANAGER_STATS
+  template <typename T>
+  Stats LockFreeObjectAllocator<T>::GetStats() const
+  {
+    Stats stats;
+    {
+      std::lock_guard<std::mutex> lock(pageLock);
+      stats = pages.GetStats();
+    }
+
+    //Every block of a page is handed to the free list when the page is created
+    stats.allocations = counters.Sum(Allocations);
+    stats.deallocations = counters.Sum(Deallocations);
+    stats.blocksInUse = stats.allocations - stats.deallocations;
+    stats.freeBlocks -= stats.blocksInUse;
+    if (stats.blocksInUse > stats.mostBlocksInUse)
+    {
+      stats.mostBlocksInUse = stats.blocksInUse;
+    }
+    return stats;
+  }
+#endif
+
+  template <typename T>
+  GenericObject * LockFreeObjectAllocator<T>::PopBlock()
+  {
+    GenericObject * p = freeList.Pop();
+    if (p == nullptr)
+    {
+      //Create a page and splice all but one of its blocks on to the free list
+      GenericObject * head;
+      GenericObject * tail;
+      {
+        std::lock_guard<std::mutex> lock(pageLock);
+        head = pages.CreatePage(tail);
+      }
+
+      p = head;
+      if (head != tail)
+      {
+        freeList.PushChain(head->next, tail);
+      }
+    }
+    return p;
+  }
+}
+
+#endif // LockFreeObjectAllocator_h
@@ -7,49 +7,138 @@
 
 namespace MemoryManager
 {
-  // Handle allocator
+  // Handle table
 #ifdef MEMORYMANAGER_DEBUG
-  ObjectAllocator<Handle> Handle::HandleAllocator(MEMORYHANDLE_ALLOCATOR_LOGFILE);
+  HandleTable Handle::Table(MEMORYHANDLE_ALLOCATOR_LOGFILE);
 #else
-  ObjectAllocator<Handle> Handle::HandleAllocator;
+  HandleTable Handle::Table;
 #endif
 
-  // Constructs a memory handle
+  // Null memory handle
+  Handle Handle::Null;
+
+  // Constructs the handle table. Chunks are created as ids are needed.
+#ifdef MEMORYMANAGER_DEBUG
+  HandleTable::HandleTable(char const * logFile) :
+#else
+  HandleTable::HandleTable() :
+#endif
+    chunks(),
+    freeLists(),
+    freeChunks(),
+    chunkCount(0),
+    liveHandles(0)
 #ifdef MEMORYMANAGER_DEBUG
-  Handle & Handle::CreateHandle(void * allocator, void * memory, char const * file, unsigned line)
+    , logStream(logFile)
+#endif
   {
-    return *(new (Handle::HandleAllocator.Allocate(file, line)) Handle(allocator, memory));
   }
 
-  int Handle::GetNumberOfAllocatedHandles()
+  // Frees the chunks of the handle table.
+  HandleTable::~HandleTable()
   {
-    return HandleAllocator.GetStats().blocksInUse;
+    for (unsigned c = 0; c < chunkCount; ++c)
+    {
+      delete chunks[c];
+    }
   }
 
+  // Allocates a chunk and links its ids in order. Id 0 is the null handle and is never handed out.
+  unsigned HandleTable::AddChunk()
+  {
+    if (chunkCount == MEMORYMANAGER_MAX_HANDLE_CHUNKS)
+    {
+      throw std::bad_alloc();
+    }
+
+    Chunk * chunk = new Chunk();
+    std::uint32_t first = chunkCount * MEMORYMANAGER_HANDLE_CHUNK_SIZE;
+    for (unsigned i = 0; i < MEMORYMANAGER_HANDLE_CHUNK_SIZE; ++i)
+    {
+      std::uint32_t next = i + 1 < MEMORYMANAGER_HANDLE_CHUNK_SIZE ? first + i + 1 : 0;
+      chunk->allocator[i] = reinterpret_cast<void *>(static_cast<std::uintptr_t>(next));
+    }
+
+    unsigned c = chunkCount++;
+    chunks[c] = chunk;
+    freeLists[c] = first == 0 ? 1 : first;
+    freeChunks[c / 64] |= std::uint64_t(1) << (c % 64);
+    return c;
+  }
+
+  // Takes an id from the lowest chunk with free ids, creating a chunk if there is none.
+#ifdef MEMORYMANAGER_DEBUG
+  std::uint32_t HandleTable::Create(void * allocator, void * memory, char const * file, unsigned line)
 #else
-  Handle & Handle::CreateHandle(void * allocator, void * memory)
+  std::uint32_t HandleTable::Create(void * allocator, void * memory)
+#endif
   {
-    return *MM_ALLOC(Handle::HandleAllocator, Handle(allocator, memory));
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+    unsigned words = (chunkCount + 63) / 64;
+    unsigned word = 0;
+    while (word < words && freeChunks[word] == 0)
+    {
+      ++word;
+    }
+    unsigned c = word < words ? word * 64 + CountTrailingZeros(freeChunks[word]) : AddChunk();
+
+    std::uint32_t id = freeLists[c];
+    Chunk & chunk = *chunks[c];
+    unsigned index = id % MEMORYMANAGER_HANDLE_CHUNK_SIZE;
+    freeLists[c] = static_cast<std::uint32_t>(reinterpret_cast<std::uintptr_t>(chunk.allocator[index]));
+    if (freeLists[c] == 0)
+    {
+      freeChunks[c / 64] &= ~(std::uint64_t(1) << (c % 64));
+    }
+
+    chunk.memory[index] = memory;
+    chunk.allocator[index] = allocator;
+    chunk.refCount[index] = 0;
+#ifdef MEMORYMANAGER_DEBUG
+    chunk.filename[index] = file;
+    chunk.line[index] = line;
+#endif
+    ++liveHandles;
+    return id;
   }
+
+  // Returns an id to its chunk's free list and bumps its generation.
+  void HandleTable::Release(std::uint32_t id)
+  {
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+    std::lock_guard<std::mutex> guard(lock);
 #endif
-  // Null memory handle
-  Handle Handle::Null;
+    unsigned c = id / MEMORYMANAGER_HANDLE_CHUNK_SIZE;
+    unsigned index = id % MEMORYMANAGER_HANDLE_CHUNK_SIZE;
+    Chunk & chunk = *chunks[c];
+    chunk.memory[index] = nullptr;
+    ++chunk.generation[index];
+    chunk.allocator[index] = reinterpret_cast<void *>(static_cast<std::uintptr_t>(freeLists[c]));
+    freeLists[c] = id;
+    freeChunks[c / 64] |= std::uint64_t(1) << (c % 64);
+    --liveHandles;
+  }
+
+  // Constructs a memory handle
+#ifdef MEMORYMANAGER_DEBUG
+  Handle Handle::CreateHandle(void * allocator, void * memory, char const * file, unsigned line)
+  {
+    return Handle(Table.Create(allocator, memory, file, line));
+  }
 
-  // Standard constructor
-  Handle::Handle(void * allocator, void * memory) :
-    memory(memory),
-    allocator(allocator),
-    refCount(0)
+  int Handle::GetNumberOfAllocatedHandles()
   {
+    return static_cast<int>(Table.GetLiveHandles());
   }
 
-  // Constructor for null memory handle.
-  Handle::Handle() :
-    memory(nullptr),
-    allocator(nullptr),
-    refCount(1)
+#else
+  Handle Handle::CreateHandle(void * allocator, void * memory)
   {
+    return Handle(Table.Create(allocator, memory));
   }
+#endif
 
   // Remove reference from handle
 #ifdef MEMORYMANAGER_DEBUG
@@ -58,34 +147,44 @@ namespace MemoryManager
   void Handle::RemoveRef()
 #endif
   {
-    --refCount;
+    if (id == 0)
+    {
+      return;
+    }
+
+    HandleRefCount & refCount = Table.GetChunk(id).refCount[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+    //Acquire so the thread deleting the handle sees all writes made through other references
+    int count = refCount.fetch_sub(1, std::memory_order_acq_rel) - 1;
+#else
+    int count = --refCount;
+#endif
 
 #ifdef MEMORYMANAGER_DEBUG
-    if (refCount < 0)
+    if (count < 0)
     {
-      DebugHeader const * dbg = Handle::HandleAllocator.GetDebugHeader(this);
-      Handle::HandleAllocator.GetLogStream()
+      Table.GetLogStream()
         << "[Handle]: Negative RefCount detected from remove at: "
         << filename << " #" << line
         << "Memory allocated at: "
-        << dbg->filename << " #" << dbg->line;
+        << GetFilename() << " #" << GetLine();
 #ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
       throw MemoryManagerException("Negative RefCount detected.", filename, line);
 #endif
     }
 #endif
 
-    //Delete handle when there are no remaining references to it
-    if (refCount <= 0)
+    //Release the handle when there are no remaining references to it
+    if (count == 0)
     {
       //Memory should be freed before all references are removed
 #if defined(MEMORYMANAGER_ENABLE_EXCEPTIONS) && defined(MEMORYMANAGER_DEBUG)
-      if (memory != nullptr)
+      if (GetRawPointer() != nullptr)
       {
         throw MemoryManagerException("Dangling reference: All references removed before pointer freed.", filename, line);
       }
 #endif
-      MM_FREE(Handle::HandleAllocator, this);
+      Table.Release(id);
     }
   }
 }
@@ -7,36 +7,204 @@ Memory handle class.
 #ifndef MemoryHandle_h
 #define MemoryHandle_h
 
+#include <cstdint>
+#include <fstream>
 #include "ObjectAllocator.h"
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+#include <atomic>
+#include <mutex>
+#endif
+
+// Number of handles in each chunk of the handle table. Must be a power of two.
+#ifndef MEMORYMANAGER_HANDLE_CHUNK_SIZE
+#define MEMORYMANAGER_HANDLE_CHUNK_SIZE 4096
+#endif
+
+// Most chunks the handle table can grow to.
+#ifndef MEMORYMANAGER_MAX_HANDLE_CHUNKS
+#define MEMORYMANAGER_MAX_HANDLE_CHUNKS 4096
+#endif
 
 namespace MemoryManager
 {
-  // Memory handle class. Stores and manages an ObjectAllocator pointer.
-  class Handle
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+  // Reference count for handles shared between threads.
+  typedef std::atomic<int> HandleRefCount;
+
+  // Generation of a handle id shared between threads.
+  typedef std::atomic<std::uint32_t> HandleGeneration;
+
+  // Memory of a handle shared between threads. Weak references read it while it is freed.
+  typedef std::atomic<void *> HandleMemory;
+#else
+  // Reference count for handles.
+  typedef int HandleRefCount;
+
+  // Generation of a handle id. Counts how many times the id has been released.
+  typedef std::uint32_t HandleGeneration;
+
+  // Memory of a handle.
+  typedef void * HandleMemory;
+#endif
+
+  /*
+    Table of every handle. Each field of a handle lives in its own array indexed by the handle's id,
+    so dereferencing only touches the memory array. The arrays grow a chunk at a time and entries
+    never move. Each chunk links its free ids through the allocator array, and new handles come from
+    the lowest chunk with free ids, so handles in use stay packed. Releasing an id bumps its
+    generation, so weak references can tell a reused id apart. Id 0 is the null handle.
+  */
+  class HandleTable
   {
-    // Handle allocator.
-    static ObjectAllocator<Handle> HandleAllocator;
+  public:
+    // A chunk of the table.
+    struct Chunk
+    {
+      // Memory managed by each handle. Null for freed memory and free ids.
+      HandleMemory    memory[MEMORYMANAGER_HANDLE_CHUNK_SIZE];
 
-    // Private constructor to prevent creating own handles
-    Handle(void * memory, void * allocator);
-    Handle(Handle const & rhs) {}
+      // Allocator that owns the memory of each handle. Holds the next free id for free ids.
+      void *          allocator[MEMORYMANAGER_HANDLE_CHUNK_SIZE];
 
-    // Null handle constructor
-    Handle();
+      // Reference count of each handle.
+      HandleRefCount  refCount[MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+
+      // Generation of each id.
+      HandleGeneration generation[MEMORYMANAGER_HANDLE_CHUNK_SIZE];
 
-    // Memory managed by this handle instance.
-    void *	memory;
+#ifdef MEMORYMANAGER_DEBUG
+      // File where each handle was created.
+      char const *    filename[MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+
+      // Line where each handle was created.
+      unsigned        line[MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+#endif
+    };
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logFile - the log file for handle errors
+    */
+    HandleTable(char const * logFile);
+#else
+    HandleTable();
+#endif
 
-    // Allocator that owns the memory.
-    void *	allocator;
+    // Destructor. Frees the chunks.
+    ~HandleTable();
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Takes a free id and sets up its entry with no references.
+      allocator - the allocator that owns the memory
+      memory    - the memory
+      file      - the file where the handle was created
+      line      - the line where the handle was created
+    */
+    std::uint32_t Create(void * allocator, void * memory, char const * file, unsigned line);
+
+    // Gets the log stream for handle errors.
+    std::ostream & GetLogStream() { return logStream; }
+#else
+    std::uint32_t Create(void * allocator, void * memory);
+#endif
 
-    // Reference count for the handle.
-    int		  refCount;
+    // Returns an id to its chunk's free list and bumps its generation.
+    void Release(std::uint32_t id);
+
+    // Gets the chunk holding an id.
+    inline Chunk & GetChunk(std::uint32_t id) const
+    {
+      return *chunks[id / MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+    }
+
+    // Gets the number of ids in use.
+    inline unsigned GetLiveHandles() const
+    {
+      return liveHandles;
+    }
+
+    /*
+      Calls a function on the id of every handle managing memory from an allocator.
+      allocator - the allocator
+      function  - called with each id
+    */
+    template <typename Function>
+    void ForEach(void const * allocator, Function && function);
+
+  private:
+    // Prevent copy and assignment.
+    HandleTable(HandleTable const & rhs);
+    HandleTable & operator=(HandleTable const & rhs);
+
+    // Allocates a chunk with every id free. Returns its index.
+    unsigned AddChunk();
+
+    // Chunks of the table. Only the first chunkCount are allocated.
+    Chunk *         chunks[MEMORYMANAGER_MAX_HANDLE_CHUNKS];
+
+    // First free id of each chunk, or 0 if the chunk is full.
+    std::uint32_t   freeLists[MEMORYMANAGER_MAX_HANDLE_CHUNKS];
+
+    // One bit per chunk with free ids.
+    std::uint64_t   freeChunks[(MEMORYMANAGER_MAX_HANDLE_CHUNKS + 63) / 64];
+
+    // Number of chunks allocated.
+    unsigned        chunkCount;
+
+    // Number of ids in use.
+    unsigned        liveHandles;
+
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+    // Guards the free lists and chunk creation.
+    std::mutex      lock;
+#endif
+
+#ifdef MEMORYMANAGER_DEBUG
+    // Log stream for handle errors.
+    std::ofstream   logStream;
+#endif
+  };
+
+  template <typename Function>
+  void HandleTable::ForEach(void const * allocator, Function && function)
+  {
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+    std::lock_guard<std::mutex> guard(lock);
+#endif
+    for (unsigned c = 0; c < chunkCount; ++c)
+    {
+      Chunk & chunk = *chunks[c];
+      for (unsigned i = 0; i < MEMORYMANAGER_HANDLE_CHUNK_SIZE; ++i)
+      {
+        if (chunk.memory[i] != nullptr && chunk.allocator[i] == allocator)
+        {
+          function(static_cast<std::uint32_t>(c * MEMORYMANAGER_HANDLE_CHUNK_SIZE + i));
+        }
+      }
+    }
+  }
+
+  // Memory handle class. Refers to an entry of the handle table that stores an ObjectAllocator pointer.
+  class Handle
+  {
+    // Handle table.
+    static HandleTable Table;
+
+    // Constructs a handle for an id.
+    explicit Handle(std::uint32_t id) : id(id) {}
+
+    // Id of the handle in the table.
+    std::uint32_t id;
 
   public:
-    // Handle representing the null instance. This is not managed by the allocator.
+    // Handle representing the null instance. This is not managed by the table.
     static Handle Null;
 
+    // Null handle constructor
+    Handle() : id(0) {}
+
 #ifdef MEMORYMANAGER_DEBUG
     /*
       Allocates and initializes a handle
@@ -45,8 +213,8 @@ namespace MemoryManager
       file      - the file where the allocation occurred
       line      - the line where the allocation occurerd
     */
-    static Handle & CreateHandle(void * allocator, void * memory, char const * file, unsigned line);
-    
+    static Handle CreateHandle(void * allocator, void * memory, char const * file, unsigned line);
+
     // Gets the number of handles currently allocated. Used for testing.
     static int GetNumberOfAllocatedHandles();
 
@@ -57,28 +225,94 @@ namespace MemoryManager
     */
     void RemoveRef(char const * filename = nullptr, unsigned line = 0);
 #else
-    static Handle & CreateHandle(void * allocator, void * memory);
+    static Handle CreateHandle(void * allocator, void * memory);
     void RemoveRef();
 #endif
 
+    /*
+      Calls a function on every handle managing memory from an allocator.
+      allocator - the allocator
+      function  - called with a Handle for each handle
+    */
+    template <typename Function>
+    static void ForEachHandle(void const * allocator, Function && function)
+    {
+      Table.ForEach(allocator, [&](std::uint32_t id) { function(Handle(id)); });
+    }
+
     // Add reference to the handle
-    inline void Handle::AddRef()
+    inline void AddRef()
+    {
+      if (id == 0)
+      {
+        return;
+      }
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+      Table.GetChunk(id).refCount[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE].fetch_add(1, std::memory_order_relaxed);
+#else
+      ++Table.GetChunk(id).refCount[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+#endif
+    }
+
+    /*
+      Adds a reference if the handle still has the given generation and its memory has not been
+      freed. Used by weak references. Returns true if a reference was added.
+      generation - the generation the handle had when it was observed
+    */
+    inline bool TryAddRef(std::uint32_t generation)
+    {
+      if (id == 0)
+      {
+        return false;
+      }
+      HandleTable::Chunk & chunk = Table.GetChunk(id);
+      unsigned index = id % MEMORYMANAGER_HANDLE_CHUNK_SIZE;
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+      //Only add to a count that is still live, so a handle being released is never revived
+      int count = chunk.refCount[index].load(std::memory_order_relaxed);
+      do
+      {
+        if (count <= 0 || chunk.generation[index].load(std::memory_order_acquire) != generation)
+        {
+          return false;
+        }
+      } while (!chunk.refCount[index].compare_exchange_weak(count, count + 1, std::memory_order_acquire, std::memory_order_relaxed));
+
+      //The id may have been released and reused before the count was taken
+      if (chunk.generation[index].load(std::memory_order_acquire) != generation || chunk.memory[index] == nullptr)
+      {
+        RemoveRef();
+        return false;
+      }
+      return true;
+#else
+      if (chunk.generation[index] != generation || chunk.refCount[index] <= 0 || chunk.memory[index] == nullptr)
+      {
+        return false;
+      }
+      ++chunk.refCount[index];
+      return true;
+#endif
+    }
+
+    // Gets the generation of the handle's id. Changes when the id is released.
+    inline std::uint32_t GetGeneration() const
     {
-      ++refCount;
+      return id == 0 ? 0 : static_cast<std::uint32_t>(Table.GetChunk(id).generation[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE]);
     }
 
     // Gets the value stored by the handle.
     template <typename T>
     inline T * Get() const
     {
+      void * memory = GetRawPointer();
 #ifdef MEMORYMANAGER_DEBUG
       if (memory == nullptr)
       {
         // Dangling pointer access. Log error.
-        DebugHeader const * dbg = Handle::HandleAllocator.GetDebugHeader(this);
-        Handle::HandleAllocator.GetLogStream() << "[Handle]: Attempt to access freed memory. Memory allocated at " << dbg->filename << " #" << dbg->line;
+        Table.GetLogStream() << "[Handle]: Attempt to access freed memory. Memory allocated at " << GetFilename() << " #" << GetLine();
 #ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
-        throw MemoryManagerException("Attempt to access freed memory.", dbg->filename, dbg->line);
+        throw MemoryManagerException("Attempt to access freed memory.", GetFilename(), GetLine());
 #endif
       }
 #endif
@@ -94,36 +328,35 @@ namespace MemoryManager
     template <typename T>
     inline void Free(const char * file, unsigned line)
     {
+      void * memory = GetRawPointer();
       if (memory == nullptr)
       {
         //Dangling pointer free
-        DebugHeader const * dbg = Handle::HandleAllocator.GetDebugHeader(this);
-        Handle::HandleAllocator.GetLogStream() 
-          << "[Handle]: Attempt to free freed memory. Free attempt at: " 
+        Table.GetLogStream()
+          << "[Handle]: Attempt to free freed memory. Free attempt at: "
           << file << " #" << line
           << "Memory allocated at: "
-          << dbg->filename << " #" << dbg->line;
+          << GetFilename() << " #" << GetLine();
 #ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
         throw MemoryManagerException("Attempt to free freed memory.", file, line);
 #endif
       }
       else
       {
-        unsigned char errorCode = static_cast<ObjectAllocator<T>*>(allocator)->Free(memory, file, line);
+        unsigned char errorCode = static_cast<ObjectAllocator<T>*>(GetAllocator())->Free(memory, file, line);
         if (errorCode != 0)
         {
-          DebugHeader const * dbg = Handle::HandleAllocator.GetDebugHeader(this);
-          Handle::HandleAllocator.GetLogStream()
+          Table.GetLogStream()
             << "[Handle]: Invalid free attempt failed at: "
             << file << " #" << line
             << "Memory allocated at: "
-            << dbg->filename << " #" << dbg->line;
+            << GetFilename() << " #" << GetLine();
 #ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
           throw MemoryManagerException("Invalid free attempt.", file, line);
 #endif
         }
 
-        memory = nullptr;
+        DetachMemory();
       }
     }
 #else
@@ -131,10 +364,11 @@ namespace MemoryManager
     template <typename T>
     inline void Free()
     {
+      void * memory = GetRawPointer();
       if (memory != nullptr)
       {
-        static_cast<ObjectAllocator<T>*>(allocator)->Free(memory);
-        memory = nullptr;
+        static_cast<ObjectAllocator<T>*>(GetAllocator())->Free(memory);
+        DetachMemory();
       }
     }
 #endif
@@ -143,29 +377,86 @@ namespace MemoryManager
     // Gets the current reference count for the handle.
     inline int GetRefCount() const
     {
-      return refCount;
+      return id == 0 ? 1 : static_cast<int>(Table.GetChunk(id).refCount[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE]);
+    }
+
+    // Gets the file where the handle was created.
+    inline char const * GetFilename() const
+    {
+      return id == 0 ? "" : Table.GetChunk(id).filename[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE];
     }
 
+    // Gets the line where the handle was created.
+    inline unsigned GetLine() const
+    {
+      return id == 0 ? 0 : Table.GetChunk(id).line[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+    }
+#endif
+
     // Gets the allocator for the memory associated with the handle.
-    inline void const * GetAllocator() const
+    inline void * GetAllocator() const
     {
-      return allocator;
+      return id == 0 ? nullptr : Table.GetChunk(id).allocator[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE];
     }
+
+    /*
+      Clears the memory managed by the handle without freeing it, and returns it.
+      Used to free the memory of several handles in one batch.
+    */
+    inline void * DetachMemory()
+    {
+      if (id == 0)
+      {
+        return nullptr;
+      }
+      HandleMemory & memory = Table.GetChunk(id).memory[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE];
+#ifdef MEMORYMANAGER_THREADSAFE_HANDLES
+      return memory.exchange(nullptr);
+#else
+      void * p = memory;
+      memory = nullptr;
+      return p;
 #endif
+    }
+
+    /*
+      Points the handle at the new location of its memory after the allocator moved it.
+      memory - the new location
+    */
+    inline void Relocate(void * memory)
+    {
+      Table.GetChunk(id).memory[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE] = memory;
+    }
+
     // Gets the raw pointer managed by the handle.
     inline void * GetRawPointer() const
     {
-      return memory;
+      return id == 0 ? nullptr : static_cast<void *>(Table.GetChunk(id).memory[id % MEMORYMANAGER_HANDLE_CHUNK_SIZE]);
     }
 
     // Checks whether the current handle is null.
     inline bool IsNull() const
     {
-      return memory == nullptr;
+      return GetRawPointer() == nullptr;
+    }
+
+    // Gets the id of the handle in the handle table. The null handle has id 0.
+    inline std::uint32_t GetId() const
+    {
+      return id;
+    }
+
+    // Equality operator. Returns true if both refer to the same handle.
+    inline bool operator==(Handle const & rhs) const
+    {
+      return id == rhs.id;
     }
-  };
 
-  // Static instance of ObjectAllocator for all handles.
-  static ObjectAllocator<Handle> handleAllocator;
+    // Inequality operator.
+    inline bool operator!=(Handle const & rhs) const
+    {
+      return id != rhs.id;
+    }
+  };
 }
 #endif // MemoryHandle_h
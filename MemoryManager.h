@@ -2,7 +2,14 @@
 #define MemoryManager_h
 
 #include "ObjectAllocator.h"
+#include "ConcurrentObjectAllocator.h"
+#include "NumaObjectAllocator.h"
+#include "LockFreeObjectAllocator.h"
+#include "SmallObjectAllocator.h"
+#include "PoolAllocator.h"
+#include "ArenaAllocator.h"
 #include "MemoryHandle.h"
 #include "Pointer.h"
+#include "GenerationalHandle.h"
 
 #endif // MemoryManager_h
\ No newline at end of file
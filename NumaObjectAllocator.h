@@ -0,0 +1,335 @@
+/*----------------------------------------------------
+NumaObjectAllocator.h
+
+Thread-safe object allocator with a pool per NUMA node.
+----------------------------------------------------*/
+#ifndef NumaObjectAllocator_h
+#define NumaObjectAllocator_h
+
+#include <cassert>
+#include "ConcurrentObjectAllocator.h"
+#include "NumaTopology.h"
+
+namespace MemoryManager
+{
+  // Settings for NumaObjectAllocator
+  struct NumaObjectAllocatorSettings : ConcurrentObjectAllocatorSettings
+  {
+    // Topology of the machine. Null uses SystemNumaTopology::Instance().
+    NumaTopology *  topology = nullptr;
+
+    // Whether to bind the pages of each node to that node. Otherwise pages are placed by first touch.
+    bool            bindPages = true;
+  };
+
+  /*
+    Thread-safe object allocator that keeps a separate ConcurrentObjectAllocator, with its own pages
+    and free lists, for each NUMA node. Objects are allocated from the pool of the node the calling
+    thread runs on, and the pages of each pool are bound to its node. A freed block goes back to the
+    pool of the node it was allocated on, wherever it is freed from. Each page records its node in
+    its page header, so freeing does not search. On a single node machine there is one pool and
+    pages are not bound.
+  */
+  template <typename T>
+  class NumaObjectAllocator
+  {
+    // Feeds the pages of a node's pool. Tags each page with the node and binds it to the node.
+    class NodePageSource : public PageSource
+    {
+    public:
+      // Allocator the node belongs to.
+      NumaObjectAllocator * owner = nullptr;
+
+      // The node.
+      unsigned node = 0;
+
+      virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+      {
+        assert(alignment == owner->pageAlignment);
+        PageHeader * page = static_cast<PageHeader*>(owner->settings.pageSource->AllocatePage(size, alignment));
+        if (page != nullptr)
+        {
+          page->tag = node;
+          if (owner->settings.bindPages && owner->nodeCount > 1)
+          {
+            owner->topology->BindMemory(page, size, node);
+          }
+        }
+        return page;
+      }
+
+      virtual void ReleasePage(void * page, std::size_t size, std::size_t alignment)
+      {
+        owner->settings.pageSource->ReleasePage(page, size, alignment);
+      }
+    };
+
+    // Pool of a single node.
+    struct Node
+    {
+      // Page source of the pool.
+      NodePageSource                source;
+
+      // The pool.
+      ConcurrentObjectAllocator<T>  pool;
+
+#ifdef MEMORYMANAGER_DEBUG
+      // Constructor.
+      Node(std::ostream * logStream, ConcurrentObjectAllocatorSettings settings) :
+        pool(logStream, WithPageSource(settings, &source))
+      {
+      }
+#else
+      // Constructor.
+      Node(ConcurrentObjectAllocatorSettings settings) :
+        pool(WithPageSource(settings, &source))
+      {
+      }
+#endif
+
+      // Returns a copy of settings that takes pages from the given source.
+      static ConcurrentObjectAllocatorSettings WithPageSource(ConcurrentObjectAllocatorSettings settings, PageSource * pageSource)
+      {
+        settings.pageSource = pageSource;
+        return settings;
+      }
+    };
+
+#ifdef MEMORYMANAGER_DEBUG
+    // Size of the debug header of each block.
+    static constexpr unsigned headerSize = sizeof(DebugHeader);
+#else
+    // Size of the debug header of each block.
+    static constexpr unsigned headerSize = 0;
+#endif
+
+    // Prevent copy and assignment.
+    NumaObjectAllocator(NumaObjectAllocator const & rhs) = delete;
+    NumaObjectAllocator & operator=(NumaObjectAllocator const & rhs) = delete;
+
+    // Settings for the allocator.
+    NumaObjectAllocatorSettings settings;
+
+    // Topology of the machine.
+    NumaTopology *              topology;
+
+    // Number of nodes with a pool.
+    unsigned                    nodeCount;
+
+    // Alignment of the pages of the pools. Used to find the page header of a block.
+    std::size_t                 pageAlignment;
+
+    // Pools of each node.
+    Node *                      nodes[MEMORYMANAGER_MAX_NUMA_NODES];
+
+  public:
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logStream - The log stream to use. Shared by the pools of every node.
+      settings  - settings for the allocator
+    */
+    NumaObjectAllocator(std::ostream * logStream = nullptr, NumaObjectAllocatorSettings settings = NumaObjectAllocatorSettings());
+#else
+    NumaObjectAllocator(NumaObjectAllocatorSettings settings = NumaObjectAllocatorSettings());
+#endif
+
+    // Destructor.
+    ~NumaObjectAllocator();
+
+    // Gets the number of nodes with a pool. 1 on a single node machine.
+    unsigned GetNodeCount() const { return nodeCount; }
+
+    /*
+      Gets the node a block was allocated on.
+      mem - the block. Must have been allocated by this allocator.
+    */
+    unsigned GetNode(void const * mem) const;
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Dumps all memory in use to the output stream, node by node.
+      outputStream - output stream to dump to.
+    */
+    void DumpMemoryInUse(std::ostream & outputStream) const;
+
+    /*
+      Allocates and returns a block from the node of the calling thread.
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    void * Allocate(const char * file, unsigned line);
+
+    /*
+      Frees an allocated block to the node it was allocated on. Checks the validity of the free and
+      returns an error code or throws if the free is invalid.
+      mem  - the block to free.
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    unsigned char Free(void * mem, char const * file, unsigned line);
+#else
+    void * Allocate();
+    void Free(void * mem);
+#endif
+
+    // Returns the blocks cached by the calling thread to the central free list of every node.
+    void Flush();
+
+#ifdef MEMORYMANAGER_STATS
+    // Get allocator statistics, summed over every node.
+    Stats GetStats() const;
+#endif
+
+  private:
+    // Gets the node of the calling thread. Nodes without a pool use node 0.
+    unsigned GetCurrentNode() const;
+  };
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  NumaObjectAllocator<T>::NumaObjectAllocator(std::ostream * logStream, NumaObjectAllocatorSettings settings) :
+#else
+  template <typename T>
+  NumaObjectAllocator<T>::NumaObjectAllocator(NumaObjectAllocatorSettings settings) :
+#endif
+    settings(settings),
+    topology(settings.topology != nullptr ? settings.topology : &SystemNumaTopology::Instance()),
+    nodeCount(topology->GetNodeCount()),
+    pageAlignment(RuntimeLayout::Geometry<sizeof(T), alignof(T), headerSize>(WithFreeList(settings)).pageAlignment)
+  {
+    if (this->settings.pageSource == nullptr)
+    {
+      this->settings.pageSource = &HeapPageSource::Instance();
+    }
+    if (nodeCount == 0)
+    {
+      nodeCount = 1;
+    }
+    else if (nodeCount > MEMORYMANAGER_MAX_NUMA_NODES)
+    {
+      nodeCount = MEMORYMANAGER_MAX_NUMA_NODES;
+    }
+
+    for (unsigned i = 0; i < nodeCount; ++i)
+    {
+#ifdef MEMORYMANAGER_DEBUG
+      nodes[i] = new Node(logStream, this->settings);
+#else
+      nodes[i] = new Node(this->settings);
+#endif
+      nodes[i]->source.owner = this;
+      nodes[i]->source.node = i;
+    }
+  }
+
+  template <typename T>
+  NumaObjectAllocator<T>::~NumaObjectAllocator()
+  {
+    for (unsigned i = 0; i < nodeCount; ++i)
+    {
+      delete nodes[i];
+    }
+  }
+
+  template <typename T>
+  unsigned NumaObjectAllocator<T>::GetCurrentNode() const
+  {
+    if (nodeCount == 1)
+    {
+      return 0;
+    }
+
+    unsigned node = topology->GetCurrentNode();
+    return node < nodeCount ? node : 0;
+  }
+
+  template <typename T>
+  unsigned NumaObjectAllocator<T>::GetNode(void const * mem) const
+  {
+    if (nodeCount == 1)
+    {
+      return 0;
+    }
+
+    //Nodes past the pools, from a block of another allocator, use node 0
+    PageHeader const * page = reinterpret_cast<PageHeader const *>(reinterpret_cast<std::uintptr_t>(mem) & ~static_cast<std::uintptr_t>(pageAlignment - 1));
+    return page->tag < nodeCount ? page->tag : 0;
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  void * NumaObjectAllocator<T>::Allocate(const char * file, unsigned line)
+  {
+    return nodes[GetCurrentNode()]->pool.Allocate(file, line);
+  }
+
+  template <typename T>
+  unsigned char NumaObjectAllocator<T>::Free(void * mem, char const * file, unsigned line)
+  {
+    //Let a pool report a null free
+    return nodes[mem != nullptr ? GetNode(mem) : 0]->pool.Free(mem, file, line);
+  }
+
+  template <typename T>
+  void NumaObjectAllocator<T>::DumpMemoryInUse(std::ostream & outputStream) const
+  {
+    for (unsigned i = 0; i < nodeCount; ++i)
+    {
+      if (nodeCount > 1)
+      {
+        outputStream << "Node " << i << ":" << std::endl;
+      }
+      nodes[i]->pool.DumpMemoryInUse(outputStream);
+    }
+  }
+#else
+  template <typename T>
+  void * NumaObjectAllocator<T>::Allocate()
+  {
+    return nodes[GetCurrentNode()]->pool.Allocate();
+  }
+
+  template <typename T>
+  void NumaObjectAllocator<T>::Free(void * mem)
+  {
+    if (mem == nullptr)
+    {
+      return;
+    }
+
+    nodes[GetNode(mem)]->pool.Free(mem);
+  }
+#endif
+
+  template <typename T>
+  void NumaObjectAllocator<T>::Flush()
+  {
+    for (unsigned i = 0; i < nodeCount; ++i)
+    {
+      nodes[i]->pool.Flush();
+    }
+  }
+
+#ifdef MEMORYMANAGER_STATS
+  template <typename T>
+  Stats NumaObjectAllocator<T>::GetStats() const
+  {
+    Stats total;
+    for (unsigned i = 0; i < nodeCount; ++i)
+    {
+      Stats stats = nodes[i]->pool.GetStats();
+      total.freeBlocks += stats.freeBlocks;
+      total.blocksInUse += stats.blocksInUse;
+      total.pagesInUse += stats.pagesInUse;
+      total.mostBlocksInUse += stats.mostBlocksInUse;
+      total.mostPagesInUse += stats.mostPagesInUse;
+      total.allocations += stats.allocations;
+      total.deallocations += stats.deallocations;
+    }
+    return total;
+  }
+#endif
+}
+
+#endif // NumaObjectAllocator_h
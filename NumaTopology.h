@@ -0,0 +1,174 @@
+/*----------------------------------------------------
+NumaTopology.h
+
+NUMA node discovery and page placement.
+----------------------------------------------------*/
+#ifndef NumaTopology_h
+#define NumaTopology_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define MEMORYMANAGER_HAS_NUMA
+#endif
+
+// Most NUMA nodes an allocator keeps pools for. Nodes past this share the pool of node 0.
+#ifndef MEMORYMANAGER_MAX_NUMA_NODES
+#define MEMORYMANAGER_MAX_NUMA_NODES 64
+#endif
+
+namespace MemoryManager
+{
+  /*
+    Describes the NUMA nodes of the machine to the allocators. Derive from it to describe a different
+    machine, such as a fake multi-node machine in a test.
+  */
+  class NumaTopology
+  {
+  public:
+    // Destructor.
+    virtual ~NumaTopology() {}
+
+    // Gets the number of nodes. Nodes are numbered from 0.
+    virtual unsigned GetNodeCount() = 0;
+
+    // Gets the node the calling thread is running on.
+    virtual unsigned GetCurrentNode() = 0;
+
+    /*
+      Asks for memory to be placed on a node. Placement is a hint, and does nothing by default.
+      memory - start of the memory
+      size   - size of the memory
+      node   - the node
+    */
+    virtual void BindMemory(void *, std::size_t, unsigned) {}
+  };
+
+  /*
+    Topology of the machine the program runs on. On Linux the nodes are read from sysfs, the current
+    node comes from getcpu, and memory is bound with the mbind system call, so libnuma is not needed.
+    Elsewhere the machine is described as a single node.
+  */
+  class SystemNumaTopology : public NumaTopology
+  {
+    // Number of nodes.
+    unsigned    nodeCount;
+#ifdef MEMORYMANAGER_HAS_NUMA
+    // Size of a system page.
+    std::size_t systemPageSize;
+
+    // Preferred node memory policy, from linux/mempolicy.h
+    static const int      PreferredPolicy = 1;
+
+    // Flag for mbind to move pages already in memory, from linux/mempolicy.h
+    static const unsigned MovePages = 1 << 1;
+#endif
+
+  public:
+    // Gets the shared instance. It is never destroyed, so allocators with static lifetime may use it.
+    static SystemNumaTopology & Instance()
+    {
+      static SystemNumaTopology * instance = new SystemNumaTopology();
+      return *instance;
+    }
+
+    // Constructor. Counts the nodes.
+    SystemNumaTopology() :
+      nodeCount(1)
+    {
+#ifdef MEMORYMANAGER_HAS_NUMA
+      systemPageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+      //The online nodes are listed as ranges, such as "0-3" or "0,2". Count up to the highest one
+      FILE * file = std::fopen("/sys/devices/system/node/online", "r");
+      if (file != nullptr)
+      {
+        unsigned highest = 0;
+        unsigned value = 0;
+        bool inNumber = false;
+        for (int c = std::fgetc(file); ; c = std::fgetc(file))
+        {
+          if (c >= '0' && c <= '9')
+          {
+            value = value * 10 + static_cast<unsigned>(c - '0');
+            inNumber = true;
+            continue;
+          }
+
+          if (inNumber && value > highest)
+          {
+            highest = value;
+          }
+          value = 0;
+          inNumber = false;
+          if (c == EOF)
+          {
+            break;
+          }
+        }
+        std::fclose(file);
+        nodeCount = highest < MEMORYMANAGER_MAX_NUMA_NODES ? highest + 1 : MEMORYMANAGER_MAX_NUMA_NODES;
+      }
+#endif
+    }
+
+    virtual unsigned GetNodeCount()
+    {
+      return nodeCount;
+    }
+
+    virtual unsigned GetCurrentNode()
+    {
+#ifdef MEMORYMANAGER_HAS_NUMA
+      if (nodeCount > 1)
+      {
+        unsigned cpu = 0;
+        unsigned node = 0;
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 29))
+        //Served from the vDSO without entering the kernel
+        getcpu(&cpu, &node);
+#elif defined(SYS_getcpu)
+        syscall(SYS_getcpu, &cpu, &node, nullptr);
+#endif
+        return node;
+      }
+#endif
+      return 0;
+    }
+
+    virtual void BindMemory(void * memory, std::size_t size, unsigned node)
+    {
+#if defined(MEMORYMANAGER_HAS_NUMA) && defined(SYS_mbind)
+      if (nodeCount == 1 || node >= MEMORYMANAGER_MAX_NUMA_NODES)
+      {
+        return;
+      }
+
+      //mbind works on whole system pages. Bind the ones inside the memory, first touch places the rest
+      std::uintptr_t start = (reinterpret_cast<std::uintptr_t>(memory) + systemPageSize - 1) & ~static_cast<std::uintptr_t>(systemPageSize - 1);
+      std::uintptr_t end = (reinterpret_cast<std::uintptr_t>(memory) + size) & ~static_cast<std::uintptr_t>(systemPageSize - 1);
+      if (end <= start)
+      {
+        return;
+      }
+
+      //Failure leaves the memory where it is, which is still correct
+      unsigned long const bits = sizeof(unsigned long) * 8;
+      unsigned long mask[(MEMORYMANAGER_MAX_NUMA_NODES + bits - 1) / bits] = {};
+      mask[node / bits] = 1ul << (node % bits);
+      syscall(SYS_mbind, start, end - start, PreferredPolicy, mask, sizeof(mask) * 8 + 1, MovePages);
+#else
+      static_cast<void>(memory);
+      static_cast<void>(size);
+      static_cast<void>(node);
+#endif
+    }
+  };
+}
+
+#endif // NumaTopology_h
@@ -12,9 +12,42 @@ Generic object allocator class
 #include <iomanip>
 #include <exception>
 #include <sstream>
+#include <unordered_set>
 #endif
 #include <cassert>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <thread>
+#include <vector>
+#include "PageSource.h"
+#include "ThreadIndex.h"
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Hints the processor to fetch the memory at an address into the cache.
+#if defined(__GNUC__) || defined(__clang__)
+#define MEMORYMANAGER_PREFETCH(address) __builtin_prefetch(address)
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <xmmintrin.h>
+#define MEMORYMANAGER_PREFETCH(address) _mm_prefetch(reinterpret_cast<char const *>(address), _MM_HINT_T0)
+#else
+#define MEMORYMANAGER_PREFETCH(address) ((void)(address))
+#endif
+
+// Statistics are always kept in debug builds. Define this to keep them in release builds as well.
+#if defined(MEMORYMANAGER_DEBUG) && !defined(MEMORYMANAGER_STATS)
+#define MEMORYMANAGER_STATS
+#endif
 
 namespace MemoryManager
 {
@@ -52,7 +85,8 @@ namespace MemoryManager
   };
 #endif // MEMORYMANAGER_ENABLE_EXCEPTIONS
 
-  // Debug header for allocations
+  // Debug header for allocations. Packed, since it sits right before the pad bytes of a block whatever the block's alignment.
+#pragma pack(push, 1)
   struct DebugHeader
   {
     // Whether the current block is allocated.
@@ -63,7 +97,11 @@ namespace MemoryManager
 
     // Line where the allocation occurred.
     unsigned		  line;
+
+    // Number of blocks of the array starting at this block, or 0 for a single object.
+    unsigned      runBlocks;
   };
+#pragma pack(pop)
 #endif // MEMORYMANAGER_DEBUG
 
   // Represents a generic pointer in the object allocator
@@ -76,6 +114,35 @@ namespace MemoryManager
     GenericObject() : next(nullptr) {}
   };
 
+  // Header at the start of every page.
+  struct PageHeader
+  {
+    // Next page in the page list.
+    PageHeader *    next;
+
+    // Previous page in the page list.
+    PageHeader *    prev;
+
+    // Freed blocks in this page.
+    GenericObject * freeList;
+
+    // Number of blocks of this page in use.
+    unsigned        liveBlocks;
+
+    // Index of the first block that was never handed out. Blocks from here to the end of the page
+    // are free without being on the free list.
+    unsigned        bumpIndex;
+
+    // First word of the occupancy bitmap with a free block, or the number of words if the page is full. Only used with FreeTracking::Bitmap.
+    unsigned        freeWord;
+
+    // Written by the page source when the page is allocated and never touched by the allocator. NumaObjectAllocator keeps the node of the page here.
+    unsigned        tag;
+
+    // Blocks of this page that belong to arrays, one bit per block. Null if the page holds no arrays.
+    std::uint64_t * arrays;
+  };
+
 #ifdef MEMORYMANAGER_DEBUG
   // Byte signature for allocated (but uninitialized) memory.
   static const unsigned char ALLOCATED = 0xAA;
@@ -92,32 +159,64 @@ namespace MemoryManager
   // Memory signature for unallocated memory.
   static const unsigned char UNALLOCATED = 0xFF;
 
+  // Error code for freeing an array with Free, a single object with FreeArray, or an array with the wrong count.
+  static const unsigned char MISMATCH = 0xCC;
+#endif
+
+#ifdef MEMORYMANAGER_STATS
   // Tracks various statistics associated with the memory manager.
   struct Stats
   {
     // Number of free (unused) blocks.
-    unsigned freeBlocks = 0;
+    std::uint64_t freeBlocks = 0;
 
     // Number of blocks currently in use.
-    unsigned blocksInUse = 0;
+    std::uint64_t blocksInUse = 0;
 
     // Number of pages in use.
-    unsigned pagesInUse = 0;
+    std::uint64_t pagesInUse = 0;
 
     // The most number of blocks in use at one time.
-    unsigned mostBlocksInUse = 0;
+    std::uint64_t mostBlocksInUse = 0;
 
     // The most number of pages in use at one time.
-    unsigned mostPagesInUse = 0;
+    std::uint64_t mostPagesInUse = 0;
 
-    // Total number of allocations.
-    unsigned allocations = 0;
+    // Total number of allocations. An array counts as one allocation.
+    std::uint64_t allocations = 0;
 
-    // Total number of deallocations
-    unsigned deallocations = 0;
+    // Total number of deallocations. An array counts as one deallocation.
+    std::uint64_t deallocations = 0;
   };
 #endif
 
+  // Which page freed blocks are reused from.
+  enum class AllocationOrder
+  {
+    // Keep allocating from the page that most recently had a block freed. Cheapest.
+    Recent,
+
+    // When the current page fills up, continue with the fullest page. Nearly empty pages drain,
+    // so they can be released.
+    FullestPage,
+
+    // When the current page fills up, continue with the page with the lowest address. Objects
+    // stay packed in the same few pages.
+    LowestPage
+  };
+
+  // How an ObjectAllocator keeps track of free blocks.
+  enum class FreeTracking
+  {
+    // Free blocks are linked together through their own memory, so blocks are at least the size of a pointer.
+    List,
+
+    // Each page keeps a bitmap of its blocks in use after its header. Freeing a block clears its bit
+    // without touching the block, blocks can be smaller than a pointer, and allocation scans the
+    // bitmap for the lowest free block.
+    Bitmap
+  };
+
   // Settings for ObjectAllocator
   struct ObjectAllocatorSettings
   {
@@ -131,10 +230,39 @@ namespace MemoryManager
     unsigned  padBytes = 0;
 #endif
 
-    // Block alignment
-    unsigned  alignment = 4;
+    // Block alignment. Must be 0 or a power of two. Blocks are always aligned for T, and for a pointer when free blocks are tracked with a list.
+    unsigned  alignment = 0;
+
+    // Puts every block on cache lines of its own, so objects used by different threads never share a line. Raises the alignment to MEMORYMANAGER_CACHE_LINE_SIZE.
+    bool      cacheLineBlocks = false;
+
+    // Most empty pages to keep. Pages beyond this are returned to the system as soon as they become empty.
+    unsigned  maxEmptyPages = UINT_MAX;
+
+    // Most pages to create at once when every page is full. The first time one page is created, and each time after twice as many as the last, up to this.
+    unsigned  maxGrowthPages = 1;
+
+    // Which page freed blocks are reused from. Blocks of a new page are always handed out in address order.
+    AllocationOrder allocationOrder = AllocationOrder::Recent;
+
+    // How free blocks are tracked. The concurrent allocators always use a list, since their caches link free blocks together.
+    FreeTracking freeTracking = FreeTracking::List;
+
+    // Source of page memory. Uses HeapPageSource if null. Must outlive the allocator.
+    PageSource * pageSource = nullptr;
   };
 
+  // Returns the smallest power of two greater than or equal to value.
+  static inline constexpr std::size_t NextPowerOfTwo(std::size_t value)
+  {
+    std::size_t result = 1;
+    while (result < value)
+    {
+      result <<= 1;
+    }
+    return result;
+  }
+
   //Pushes a GenericObject onto a stack
   static inline void Push(GenericObject * & stack, GenericObject * obj)
   {
@@ -142,6 +270,13 @@ namespace MemoryManager
     stack = obj;
   }
 
+  //Pushes a chain of GenericObjects linked from head to tail onto a stack
+  static inline void PushChain(GenericObject * & stack, GenericObject * head, GenericObject * tail)
+  {
+    tail->next = stack;
+    stack = head;
+  }
+
   //Pops a GenericObject off the stack
   static inline GenericObject * Pop(GenericObject * & stack)
   {
@@ -154,44 +289,296 @@ namespace MemoryManager
     return p;
   }
 
-  // ObjectAllocator class
-  template <typename T>
-  class ObjectAllocator
+  // Returns the number of trailing zero bits of a non-zero value.
+  static inline unsigned CountTrailingZeros(std::uint64_t value)
   {
-    // Size of the header for allocations.
-#ifdef MEMORYMANAGER_DEBUG
-    unsigned headerSize = sizeof(DebugHeader);
+#if defined(__GNUC__) || defined(__clang__)
+    return static_cast<unsigned>(__builtin_ctzll(value));
+#elif defined(_MSC_VER) && defined(_M_X64)
+    unsigned long index;
+    _BitScanForward64(&index, value);
+    return static_cast<unsigned>(index);
 #else
-    unsigned headerSize = 0;
+    unsigned count = 0;
+    while ((value & 1) == 0)
+    {
+      value >>= 1;
+      ++count;
+    }
+    return count;
 #endif
+  }
 
-    // Prevent copy and assignment.
-    ObjectAllocator(ObjectAllocator const & rhs) {}
-    ObjectAllocator & operator=(ObjectAllocator const & rhs) {}
+  /*
+    Finds the first word of a bitmap with a clear bit. Returns count if there is none.
+    words - the bitmap
+    count - number of words in the bitmap
+    start - first word to look at
+  */
+  static inline unsigned FindWordWithClearBit(std::uint64_t const * words, unsigned count, unsigned start)
+  {
+#ifdef __AVX2__
+    //Skip four full words at a time
+    __m256i const full = _mm256_set1_epi64x(-1);
+    while (start + 4 <= count)
+    {
+      __m256i block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(words + start));
+      if (_mm256_movemask_epi8(_mm256_cmpeq_epi64(block, full)) != -1)
+      {
+        break;
+      }
+      start += 4;
+    }
+#endif
+    while (start < count && words[start] == ~std::uint64_t(0))
+    {
+      ++start;
+    }
+    return start;
+  }
 
-    // Settings for the allocator.
-    ObjectAllocatorSettings settings;
+  // Returns a copy of settings that tracks free blocks with a list. Used by allocators that link free blocks together.
+  static inline ObjectAllocatorSettings WithFreeList(ObjectAllocatorSettings settings)
+  {
+    settings.freeTracking = FreeTracking::List;
+    return settings;
+  }
+
+  /*
+    Geometry of the pages of an ObjectAllocator, worked out from its layout. Blocks of pages that
+    track free blocks with a list are at least the size of a pointer, and pages that track them
+    with a bitmap keep it after the page header.
+  */
+  struct PageGeometry
+  {
+    // Number of blocks per page.
+    unsigned      blocksPerPage;
+
+    // Number of pad bytes on each side of a block.
+    unsigned      padBytes;
+
+    // Alignment of each block.
+    unsigned      alignment;
 
     // Size of each block.
-    unsigned        blockSize;
+    unsigned      blockSize;
 
     // Size of each page.
-    unsigned        pageSize;
+    unsigned      pageSize;
 
     // Number of bytes for left alignment
-    unsigned        leftAlign;
+    unsigned      leftAlign;
 
-    // Numebr of bytes for alignment between bytes.
-    unsigned        interAlign;
+    // Number of bytes for alignment between blocks.
+    unsigned      interAlign;
+
+    // Offset of the first block from the start of its page.
+    unsigned      firstBlockOffset;
+
+    // Distance between blocks, including debug bytes and alignment.
+    unsigned      blockStride;
+
+    // Rounded up 2^32 / blockStride. Used to find the index of a block without a division.
+    std::uint64_t strideReciprocal;
+
+    // Number of words in the occupancy bitmap of each page. 0 unless free blocks are tracked with a bitmap.
+    unsigned      bitmapWords;
+
+    // Size of the page header, including the occupancy bitmap.
+    unsigned      pageHeaderSize;
 #ifdef MEMORYMANAGER_DEBUG
     // Size of the left chunk. Chunks include all debug bytes with the block.
-    unsigned        leftChunkSize;
+    unsigned      leftChunkSize;
 
     // Size of the chunk in the middle of a page. Chunks include all debug bytes with the block.
-    unsigned        interChunkSize;
+    unsigned      interChunkSize;
+#endif
 
-    // Statistics of the allocator.
-    Stats           stats;
+    // Alignment of each page. Blocks find their page by masking their address with this.
+    std::size_t   pageAlignment;
+
+    /*
+      Constructor.
+      objectSize      - size of the objects
+      objectAlignment - alignment of the objects
+      headerSize      - size of the header of each block
+      blocksPerPage   - number of blocks per page
+      minAlignment    - block alignment asked for. Raised to the alignment the blocks need.
+      padBytes        - number of pad bytes
+      freeTracking    - how free blocks are tracked
+    */
+    constexpr PageGeometry(std::size_t objectSize, std::size_t objectAlignment, unsigned headerSize, unsigned blocksPerPage, unsigned minAlignment, unsigned padBytes, FreeTracking freeTracking) :
+      blocksPerPage(blocksPerPage),
+      padBytes(padBytes),
+      alignment(minAlignment),
+      blockSize(static_cast<unsigned>(objectSize)),
+      pageSize(0),
+      leftAlign(0),
+      interAlign(0),
+      firstBlockOffset(0),
+      blockStride(0),
+      strideReciprocal(0),
+      bitmapWords(0),
+      pageHeaderSize(sizeof(PageHeader)),
+#ifdef MEMORYMANAGER_DEBUG
+      leftChunkSize(0),
+      interChunkSize(0),
+#endif
+      pageAlignment(0)
+    {
+      if (freeTracking == FreeTracking::Bitmap)
+      {
+        //The bitmap follows the page header
+        bitmapWords = (blocksPerPage + 63) / 64;
+        pageHeaderSize += bitmapWords * sizeof(std::uint64_t);
+      }
+      else if (blockSize < sizeof(GenericObject*))
+      {
+        blockSize = sizeof(GenericObject*);
+      }
+
+      //Blocks hold their objects, and link the free list while free
+      if (alignment < objectAlignment)
+      {
+        alignment = static_cast<unsigned>(objectAlignment);
+      }
+      if (freeTracking == FreeTracking::List && alignment < alignof(GenericObject*))
+      {
+        alignment = alignof(GenericObject*);
+      }
+      assert((alignment & (alignment - 1)) == 0);
+
+      //Set alignment sizes. The first block and the stride are multiples of the alignment, and pages are aligned to at least the alignment.
+      if (alignment > 1)
+      {
+        leftAlign = (alignment - (pageHeaderSize + headerSize + padBytes)) % alignment;
+        interAlign = (alignment - (blockSize + headerSize + 2 * padBytes)) % alignment;
+      }
+      firstBlockOffset = pageHeaderSize + leftAlign + headerSize + padBytes;
+      blockStride = blockSize + 2 * padBytes + interAlign + headerSize;
+      strideReciprocal = (std::uint64_t(1) << 32) / blockStride + 1;
+#ifdef MEMORYMANAGER_DEBUG
+      leftChunkSize = pageHeaderSize + leftAlign + headerSize + 2 * padBytes + blockSize;
+      interChunkSize = blockSize + 2 * padBytes + interAlign + headerSize;
+#endif
+      pageSize = pageHeaderSize + leftAlign + blocksPerPage * blockStride - interAlign;
+      pageAlignment = NextPowerOfTwo(pageSize);
+    }
+  };
+
+  // Page layout of an ObjectAllocator taken from its settings when it is constructed. The default.
+  struct RuntimeLayout
+  {
+    // Geometry of the pages for objects of ObjectSize bytes and ObjectAlignment alignment with HeaderSize byte block headers.
+    template <std::size_t ObjectSize, std::size_t ObjectAlignment, unsigned HeaderSize>
+    struct Geometry : PageGeometry
+    {
+      // Constructor. Works out the geometry from the layout settings.
+      explicit Geometry(ObjectAllocatorSettings const & settings) :
+        PageGeometry(ObjectSize, ObjectAlignment, HeaderSize, settings.blocksPerPage, GetAlignment(settings), settings.padBytes, settings.freeTracking)
+      {
+      }
+
+      // Gets the alignment asked for by the settings.
+      static unsigned GetAlignment(ObjectAllocatorSettings const & settings)
+      {
+        return settings.cacheLineBlocks ? std::max<unsigned>(settings.alignment, MEMORYMANAGER_CACHE_LINE_SIZE) : settings.alignment;
+      }
+    };
+  };
+
+  /*
+    Page layout of an ObjectAllocator fixed at compile time. The geometry is made of constants, so
+    block addresses and indices, page setup and debug checks compile down to constant arithmetic,
+    and the allocator does not store it. The blocksPerPage, alignment, cacheLineBlocks, padBytes and
+    freeTracking settings are ignored.
+    BlocksPerPage - number of blocks per page
+    Alignment     - block alignment, as in the settings. MEMORYMANAGER_CACHE_LINE_SIZE puts every block on cache lines of its own.
+    PadBytes      - number of pad bytes
+    Tracking      - how free blocks are tracked
+  */
+#ifdef MEMORYMANAGER_DEBUG
+  template <unsigned BlocksPerPage, unsigned Alignment = 0, unsigned PadBytes = 2, FreeTracking Tracking = FreeTracking::List>
+#else
+  template <unsigned BlocksPerPage, unsigned Alignment = 0, unsigned PadBytes = 0, FreeTracking Tracking = FreeTracking::List>
+#endif
+  struct FixedLayout
+  {
+    static_assert(BlocksPerPage > 0, "A page needs at least one block.");
+
+    // Geometry of the pages for objects of ObjectSize bytes and ObjectAlignment alignment with HeaderSize byte block headers.
+    template <std::size_t ObjectSize, std::size_t ObjectAlignment, unsigned HeaderSize>
+    struct Geometry
+    {
+      // The geometry, worked out at compile time.
+      static constexpr PageGeometry value = PageGeometry(ObjectSize, ObjectAlignment, HeaderSize, BlocksPerPage, Alignment, PadBytes, Tracking);
+
+      static constexpr unsigned       blocksPerPage = value.blocksPerPage;
+      static constexpr unsigned       padBytes = value.padBytes;
+      static constexpr unsigned       alignment = value.alignment;
+      static constexpr unsigned       blockSize = value.blockSize;
+      static constexpr unsigned       pageSize = value.pageSize;
+      static constexpr unsigned       leftAlign = value.leftAlign;
+      static constexpr unsigned       interAlign = value.interAlign;
+      static constexpr unsigned       firstBlockOffset = value.firstBlockOffset;
+      static constexpr unsigned       blockStride = value.blockStride;
+      static constexpr std::uint64_t  strideReciprocal = value.strideReciprocal;
+      static constexpr unsigned       bitmapWords = value.bitmapWords;
+      static constexpr unsigned       pageHeaderSize = value.pageHeaderSize;
+#ifdef MEMORYMANAGER_DEBUG
+      static constexpr unsigned       leftChunkSize = value.leftChunkSize;
+      static constexpr unsigned       interChunkSize = value.interChunkSize;
+#endif
+      static constexpr std::size_t    pageAlignment = value.pageAlignment;
+
+      // Constructor. The layout settings are ignored.
+      explicit Geometry(ObjectAllocatorSettings const &)
+      {
+      }
+    };
+  };
+
+  template <typename T>
+  class ConcurrentObjectAllocator;
+
+  template <typename T>
+  class LockFreeObjectAllocator;
+
+  template <typename T, typename Layout = RuntimeLayout>
+  class ObjectRange;
+
+  /*
+    ObjectAllocator class
+    T      - type of the objects
+    Layout - page layout. RuntimeLayout takes it from the settings, FixedLayout fixes it at compile time.
+  */
+  template <typename T, typename Layout = RuntimeLayout>
+  class ObjectAllocator
+  {
+    // The concurrent allocators use this allocator as their central free list and page source.
+    friend class ConcurrentObjectAllocator<T>;
+    friend class LockFreeObjectAllocator<T>;
+
+    // Ranges walk the pages of the allocator.
+    friend class ObjectRange<T, Layout>;
+
+    // Size of the header for allocations.
+#ifdef MEMORYMANAGER_DEBUG
+    static constexpr unsigned headerSize = sizeof(DebugHeader);
+#else
+    static constexpr unsigned headerSize = 0;
+#endif
+
+    // Prevent copy and assignment.
+    ObjectAllocator(ObjectAllocator const & rhs) {}
+    ObjectAllocator & operator=(ObjectAllocator const & rhs) {}
+
+    // Settings for the allocator.
+    ObjectAllocatorSettings settings;
+
+#ifdef MEMORYMANAGER_DEBUG
+    // Pages owned by the allocator. Used to validate frees without walking the page list.
+    std::unordered_set<PageHeader const *> pageIndex;
 
     // Output stream to send logging information.
     std::ostream *  logStream;
@@ -199,12 +586,25 @@ namespace MemoryManager
     // Indicates whether the log stream is owned by the allocator, and should be deleted when the allocator is deleted.
     bool            ownsLogStream;
 #endif
+#ifdef MEMORYMANAGER_STATS
+    // Statistics of the allocator. Free blocks are derived when read.
+    Stats           stats;
+#endif
 
-    // List of current pages being used.
-    GenericObject * pageList;
+    // List of current pages being used. Pages with free blocks come before full pages.
+    PageHeader *    pageList;
 
-    // List of free blocks available to be used.
-    GenericObject * freeList;
+    // Last page in the page list.
+    PageHeader *    pageTail;
+
+    // Number of pages with no blocks in use.
+    unsigned        emptyPages;
+
+    // Number of pages to create the next time every page is full.
+    unsigned        growthPages;
+
+    // Geometry of the pages. A FixedLayout keeps it in constants, so only a RuntimeLayout stores it.
+    typename Layout::template Geometry<sizeof(T), alignof(T), headerSize> layout;
 
   public:
 #ifdef MEMORYMANAGER_DEBUG
@@ -238,9 +638,6 @@ namespace MemoryManager
     */
     void DumpMemoryInUse(std::ostream & outputStream) const;
 
-    // Get allocator statistics.
-    Stats GetStats() const { return stats; }
-
     // Get the log stream for the allocator.
     std::ostream & GetLogStream() { return *logStream; }
 
@@ -262,375 +659,2090 @@ namespace MemoryManager
       line - the line the allocation came from. Used in debug header.
     */
     unsigned char Free(void * mem, char const * file, unsigned line);
+
+    /*
+      Allocates several blocks at once. Whole runs of a page's free list are taken in one step,
+      and pages are created as needed.
+      count  - number of blocks to allocate
+      blocks - receives the blocks. The objects are not constructed.
+      file   - the file the allocation came from. Used in debug headers.
+      line   - the line the allocation came from. Used in debug headers.
+    */
+    void AllocateBatch(unsigned count, T ** blocks, const char * file, unsigned line);
+
+    /*
+      Frees several blocks at once. Every block is validated as in Free, and invalid blocks are skipped.
+      Returns the error code of the first invalid block, or 0.
+      objects - the objects to free. Null entries are ignored.
+      count   - number of objects
+      file    - the file the free came from.
+      line    - the line the free came from.
+    */
+    unsigned char FreeBatch(T * const * objects, unsigned count, char const * file, unsigned line);
+
+    /*
+      Allocates storage for an array of objects from a run of adjacent blocks of one page. The debug
+      header of the first block and the pad bytes around the array cover the whole run. Arrays that
+      do not fit in a page come from operator new. Returns null for 0 objects.
+      count - number of objects
+      file  - the file the allocation came from. Used in debug header.
+      line  - the line the allocation came from. Used in debug header.
+    */
+    void * AllocateArray(unsigned count, const char * file, unsigned line);
+
+    /*
+      Destroys and frees an array allocated with AllocateArray. Checks the validity of the free and
+      returns an error code or throws if the free is invalid.
+      objects - the array
+      count   - number of objects the array was allocated with
+      file    - the file the free came from.
+      line    - the line the free came from.
+    */
+    unsigned char FreeArray(T * objects, unsigned count, char const * file, unsigned line);
 #else
     void * Allocate();
     void Free(void * mem);
+    void AllocateBatch(unsigned count, T ** blocks);
+    void FreeBatch(T * const * objects, unsigned count);
+    void * AllocateArray(unsigned count);
+    void FreeArray(T * objects, unsigned count);
 #endif
 
-  private:
-    // Calculates the size a page should be
-    int CalculatePageSize();
+    /*
+      Returns empty pages to the system. Returns the number of pages released.
+      maxEmptyPages - number of empty pages to keep
+    */
+    unsigned Trim(unsigned maxEmptyPages = 0);
 
-    // Creates a page and populates the free list with the created blocks.
-    void CreatePage();
+    /*
+      Creates pages up front so that count blocks can be allocated one at a time without creating a
+      page. Returns the number of pages created. The pages are empty until used, so they are released
+      by Trim() and count towards maxEmptyPages.
+      count - number of blocks to make room for
+    */
+    unsigned Reserve(unsigned count);
 
-  }; //class ObjectAllocator
+    /*
+      Calls a function on every allocated object, page by page and in address order within each page.
+      Empty pages and free words of a page are skipped. The function must not allocate or free from this allocator.
+      function - called with a T & for each object
+    */
+    template <typename Function>
+    void ForEach(Function && function);
 
-#ifdef MEMORYMANAGER_DEBUG
-  template <typename T>
-  ObjectAllocator<T>::ObjectAllocator(char const * logFile, ObjectAllocatorSettings settings)
-    : ObjectAllocator(new std::ofstream(), settings)
-  {
-    ownsLogStream = true;
-    ((std::ofstream*)logStream)->open(logFile);
-  }
+    /*
+      Calls a function on the allocated objects of one part of the pages. The pages are split into
+      consecutive parts of about equal size, so each part can be visited by a different thread.
+      function - called with a T & for each object
+      part     - the part to visit. Must be less than parts.
+      parts    - number of parts. Must not be 0.
+    */
+    template <typename Function>
+    void ForEach(Function && function, unsigned part, unsigned parts);
 
-  template <typename T>
-  ObjectAllocator<T>::ObjectAllocator(std::ostream * logStream, ObjectAllocatorSettings settings) :
-#else
-  template <typename T>
-  ObjectAllocator<T>::ObjectAllocator(ObjectAllocatorSettings settings) :
+    /*
+      Calls a function on every allocated object, splitting the pages across threads. The calling
+      thread visits the first part. The function is shared by all threads.
+      function - called with a T & for each object
+      threads  - number of threads to use
+    */
+    template <typename Function>
+    void ParallelForEach(Function && function, unsigned threads);
+
+    // Gets a range over the allocated objects, in the same order as ForEach.
+    ObjectRange<T, Layout> Objects();
+
+    /*
+      Moves objects out of the least occupied pages into the free blocks of the most occupied ones,
+      and releases the pages emptied. Full pages are left alone. Returns the number of pages released.
+      Anything pointing at a moved object must be updated by relocate, so this is meant for objects
+      only reached through handles. See PointerCompact.
+      relocate - called as relocate(T * from, T * to) for each object to move. Returns false to
+                 leave the object in place, otherwise moves the object to the uninitialized block
+                 at to and destroys the object at from.
+    */
+    template <typename Relocate>
+    unsigned Compact(Relocate && relocate);
+
+#ifdef MEMORYMANAGER_STATS
+    /*
+      Get allocator statistics. The most blocks in use is sampled when blocks are freed,
+      which is the only time the number of blocks in use goes down.
+    */
+    Stats GetStats() const;
 #endif
-    settings(settings),
-    pageList(nullptr),
-    freeList(nullptr),
-    blockSize(sizeof(T)),
-    pageSize(0),
-    leftAlign(0),
-    interAlign(0)
-  {
-    if (blockSize < sizeof(GenericObject*))
+
+  private:
+    // Gets the page that owns a block.
+    inline PageHeader * GetPage(void const * mem) const
     {
-      blockSize = sizeof(GenericObject*);
+      return reinterpret_cast<PageHeader *>(reinterpret_cast<std::uintptr_t>(mem) & ~static_cast<std::uintptr_t>(layout.pageAlignment - 1));
     }
 
-    //Set alignment sizes
-    if (settings.alignment > 1)
+    // Gets a block of a page by its index.
+    inline GenericObject * GetBlock(PageHeader * page, unsigned index) const
     {
-      leftAlign = (settings.alignment - (sizeof(GenericObject*) + headerSize + settings.padBytes)) % settings.alignment;
-      interAlign = (settings.alignment - (blockSize + headerSize + 2 * settings.padBytes)) % settings.alignment;
+      return reinterpret_cast<GenericObject *>(reinterpret_cast<char *>(page) + layout.firstBlockOffset + index * layout.blockStride);
     }
-#ifdef MEMORYMANAGER_DEBUG
-    leftChunkSize = sizeof(GenericObject*) + leftAlign + headerSize + 2 * settings.padBytes + blockSize;
-    interChunkSize = blockSize + 2 * settings.padBytes + interAlign + headerSize;
-#endif
-    pageSize = CalculatePageSize();
 
-#ifdef MEMORYMANAGER_DEBUG
-    this->logStream = logStream;
-#endif
-  }
+    // Checks whether a page has blocks to hand out.
+    inline bool HasFreeBlocks(PageHeader const * page) const
+    {
+      return page->liveBlocks < layout.blocksPerPage;
+    }
 
-  // Destructor
-  template <typename T>
-  ObjectAllocator<T>::~ObjectAllocator()
-  {
-#ifdef MEMORYMANAGER_DEBUG
-    if (logStream != nullptr)
+    // Gets the index of a block in its page.
+    inline unsigned GetBlockIndex(PageHeader const * page, void const * block) const
     {
-      DumpMemoryInUse(*logStream);
+      //Offsets are exact multiples of the stride, so multiplying by the rounded up reciprocal divides exactly
+      std::uint64_t offset = static_cast<std::uint64_t>(reinterpret_cast<char const *>(block) - reinterpret_cast<char const *>(page) - layout.firstBlockOffset);
+      return static_cast<unsigned>((offset * layout.strideReciprocal) >> 32);
     }
-#endif
-    char * p = nullptr;
-    while (pageList)
+
+    // Gets the occupancy bitmap of a page. Set bits are blocks in use.
+    inline std::uint64_t * GetBitmap(PageHeader * page) const
     {
-      char * page = reinterpret_cast<char*>(Pop(pageList));
-      delete[] page;
+      return reinterpret_cast<std::uint64_t *>(page + 1);
     }
-#ifdef MEMORYMANAGER_DEBUG
-    if (ownsLogStream && logStream != nullptr)
+
+    // Hands out the lowest free block of a page by setting its bit.
+    inline GenericObject * TakeBitmapBlock(PageHeader * page)
     {
-      delete logStream;
+      std::uint64_t * bitmap = GetBitmap(page);
+      unsigned word = page->freeWord;
+      unsigned bit = CountTrailingZeros(~bitmap[word]);
+      bitmap[word] |= std::uint64_t(1) << bit;
+
+      //Only scan when the word fills up, and not at all when the page is now full
+      if (bitmap[word] == ~std::uint64_t(0))
+      {
+        page->freeWord = page->liveBlocks + 1 < layout.blocksPerPage ? FindWordWithClearBit(bitmap, layout.bitmapWords, word + 1) : layout.bitmapWords;
+      }
+      return GetBlock(page, word * 64 + bit);
     }
-#endif
-  }
 
-  template <typename T>
-  int ObjectAllocator<T>::CalculatePageSize()
-  {
-    return sizeof(GenericObject*) + leftAlign + settings.blocksPerPage * (blockSize + 2 * settings.padBytes + headerSize + interAlign) - interAlign;
-  }
+    // Number of words in the occupancy of a page.
+    inline unsigned GetOccupancyWords() const
+    {
+      return (layout.blocksPerPage + 63) / 64;
+    }
 
-#ifdef MEMORYMANAGER_DEBUG
-  template <typename T>
-  void * ObjectAllocator<T>::Allocate(const char * file, unsigned line)
-  {
-    if (freeList == nullptr)
+    // Gets a word of a page's occupancy, with bits past the last block cleared.
+    inline std::uint64_t GetOccupancyWord(std::uint64_t const * occupancy, unsigned word) const
     {
-      CreatePage();
+      if (word == (layout.blocksPerPage - 1) / 64 && layout.blocksPerPage % 64 != 0)
+      {
+        return occupancy[word] & ((std::uint64_t(1) << (layout.blocksPerPage % 64)) - 1);
+      }
+      return occupancy[word];
     }
 
-    ++stats.allocations;
-    ++stats.blocksInUse;
-    if (stats.blocksInUse > stats.mostBlocksInUse)
+    /*
+      Gets the objects of a page in use, one bit per block. Blocks of arrays are left out. Returns the
+      page's bitmap when free blocks are tracked with one and the page holds no arrays, otherwise
+      fills scratch.
+      page    - the page
+      scratch - GetOccupancyWords() words to fill
+    */
+    std::uint64_t const * GetOccupancy(PageHeader * page, std::uint64_t * scratch) const;
+
+    // Fills scratch with the blocks of a page in use from its bump index and free list.
+    void GetListOccupancy(PageHeader * page, std::uint64_t * scratch) const;
+
+    // Calls a function on every allocated object of a page.
+    template <typename Function>
+    void VisitPage(PageHeader * page, std::uint64_t * scratch, Function & function);
+
+    // Returns a block to its page by clearing its bit.
+    inline void GiveBitmapBlock(PageHeader * page, void const * block)
     {
-      stats.mostBlocksInUse = stats.blocksInUse;
+      unsigned index = GetBlockIndex(page, block);
+      GetBitmap(page)[index / 64] &= ~(std::uint64_t(1) << (index % 64));
+      if (index / 64 < page->freeWord)
+      {
+        page->freeWord = index / 64;
+      }
     }
-    --stats.freeBlocks;
 
-    //Pop the top off the free list
-    char * p = reinterpret_cast<char*>(Pop(freeList));
-    memset(p, ALLOCATED, blockSize);
+    // Moves a page that just ran out of blocks behind the pages with free blocks, and picks the next page to allocate from.
+    void OnPageFull(PageHeader * page);
 
-    //Set the debug header
-    DebugHeader * dbg = reinterpret_cast<DebugHeader*>(p - headerSize - settings.padBytes);
-    dbg->allocated = true;
-    dbg->line = line;
-    dbg->filename = file;
+    // Moves a page that was full in front of the full pages.
+    void OnPageOpened(PageHeader * page);
 
-    return (void*)p;
-  }
+    // Pops a free block off the first page, creating a page if every page is full.
+    GenericObject * PopBlock();
 
-  template <typename T>
-  unsigned char ObjectAllocator<T>::Free(void * mem, char const * filename, unsigned line)
-  {
-    DebugHeader const * header = GetDebugHeader(mem);
-    unsigned char * del = static_cast<unsigned char*>(mem);
+    // Takes a free block from a page with free blocks.
+    GenericObject * TakeBlock(PageHeader * page);
 
-    //Check for valid memory address
-    GenericObject * pages = pageList;
+    // Returns a block to its page. Releases the page if it becomes empty and there are too many empty pages.
+    void PushBlock(GenericObject * block);
 
-    while (pages)
+    // Rewinds a page with no blocks in use, so its blocks are handed out in address order again and arrays can use the whole page.
+    void RewindPage(PageHeader * page);
+
+    // Counts and rewinds a page whose last block in use was just returned. Releases it if there are too many empty pages.
+    void OnPageEmptied(PageHeader * page);
+
+    // Gets the number of adjacent blocks an array of count objects covers.
+    inline unsigned GetRunBlocks(unsigned count) const
+    {
+      std::size_t bytes = std::size_t(count) * sizeof(T);
+      return bytes <= layout.blockSize ? 1 : static_cast<unsigned>(1 + (bytes - layout.blockSize + layout.blockStride - 1) / layout.blockStride);
+    }
+
+    // Finds the first of count adjacent free blocks in a page. Returns blocksPerPage if there are none.
+    unsigned FindRun(PageHeader * page, unsigned count) const;
+
+    // Takes a run of adjacent free blocks for an array, creating a page if no page with free blocks has room.
+    GenericObject * TakeRun(unsigned count);
+
+    // Returns the run of blocks of an array to its page. Releases the page if it becomes empty and there are too many empty pages.
+    void GiveRun(GenericObject * first, unsigned count);
+
+    // Creates a page whose blocks are handed out in address order, and links it after position, or at the front of the page list if position is null.
+    PageHeader * CreatePage(PageHeader * position = nullptr);
+
+    // Creates the pages of the next growth step in front of the full pages. Returns the first, to allocate from.
+    PageHeader * Grow();
+
+    /*
+      Creates a page and returns its blocks as a chain in address order without adding them to
+      the free list. The blocks are counted as in use by the page.
+      tail - receives the last block of the chain
+    */
+    GenericObject * CreatePage(GenericObject * & tail);
+
+    // Allocates a page and sets up its memory. None of its blocks are handed out.
+    PageHeader * AllocatePage();
+
+    // Unlinks a page and returns it to the system.
+    void ReleasePage(PageHeader * page);
+
+    // Links a page at the front of the page list.
+    void LinkFront(PageHeader * page);
+
+    // Links a page at the back of the page list.
+    void LinkBack(PageHeader * page);
+
+    // Links a page after another page of the page list.
+    void LinkAfter(PageHeader * position, PageHeader * page);
+
+    // Unlinks a page from the page list.
+    void Unlink(PageHeader * page);
+
+    /*
+      Pops blocks off the free list as a chain, creating pages as needed. The blocks are counted
+      as in use, but are not initialized and are not given debug headers.
+      count - number of blocks to pop
+      tail  - receives the last block of the chain
+    */
+    GenericObject * AcquireBlocks(unsigned count, GenericObject * & tail);
+
+    /*
+      Takes runs of blocks off the pages' free lists. Blocks stay chained together. When the pages
+      hold fewer free blocks than count, every missing page is created first.
+      count  - number of blocks to take
+      tail   - receives the last block of the chain
+      blocks - optionally receives each block
+    */
+    GenericObject * TakeBlocks(unsigned count, GenericObject * & tail, T ** blocks);
+
+    /*
+      Returns destroyed objects to their pages. Consecutive objects of the same page are spliced
+      on to the page's free list together.
+    */
+    void GiveBlocks(T * const * objects, unsigned count);
+
+    /*
+      Returns a chain of uninitialized blocks to the free list.
+      head  - first block of the chain
+      tail  - last block of the chain
+      count - number of blocks in the chain
+    */
+    void ReleaseBlocks(GenericObject * head, GenericObject * tail, unsigned count);
+
+#ifdef MEMORYMANAGER_STATS
+    // Counts blocks handed out.
+    inline void CountAllocations(unsigned count)
+    {
+      stats.allocations += count;
+      stats.blocksInUse += count;
+    }
+
+    // Counts blocks returned.
+    inline void CountDeallocations(unsigned count)
+    {
+      if (stats.blocksInUse > stats.mostBlocksInUse)
+      {
+        stats.mostBlocksInUse = stats.blocksInUse;
+      }
+      stats.deallocations += count;
+      stats.blocksInUse -= count;
+    }
+
+    // Counts an array handed out. The array is one allocation covering all of its blocks.
+    inline void CountArrayAllocation(unsigned blocks)
+    {
+      ++stats.allocations;
+      stats.blocksInUse += blocks;
+    }
+
+    // Counts an array returned. The array is one deallocation covering all of its blocks.
+    inline void CountArrayDeallocation(unsigned blocks)
+    {
+      if (stats.blocksInUse > stats.mostBlocksInUse)
+      {
+        stats.mostBlocksInUse = stats.blocksInUse;
+      }
+      ++stats.deallocations;
+      stats.blocksInUse -= blocks;
+    }
+#endif
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Sets the allocated signature and debug header for a block being handed out.
+      p    - the block
+      file - the file the allocation came from
+      line - the line the allocation came from
+    */
+    void PrepareBlock(char * p, char const * file, unsigned line) const;
+
+    /*
+      Checks the validity of a free. Returns 0 if the block may be freed, otherwise an error code.
+      Throws if exceptions are enabled.
+    */
+    unsigned char ValidateFree(void * mem, char const * filename, unsigned line) const;
+
+    // Sets the freed signature and clears the debug header of a block being freed.
+    void ClearBlock(void * mem) const;
+
+    /*
+      Checks the validity of a free of a single object or an array. Returns 0 if the memory may be
+      freed, otherwise an error code. Throws if exceptions are enabled.
+      mem       - the memory to free
+      size      - size of the object or array, which the right pad bytes follow
+      runBlocks - number of blocks of the array, or 0 for a single object
+    */
+    unsigned char ValidateFree(void * mem, std::size_t size, unsigned runBlocks, char const * filename, unsigned line) const;
+
+    // Restores the signatures and debug headers of every block of a freed array.
+    void ClearRun(void * first, unsigned blocks) const;
+
+    // Sets the signatures and clears the debug headers of every block of a page, as if none was ever handed out.
+    void LayOutPage(PageHeader * page) const;
+#endif
+
+  }; //class ObjectAllocator
+
+  /*
+    Range over the allocated objects of an ObjectAllocator, page by page and in address order within
+    each page. Iterators are single pass and share the range's position, so only one of them should
+    be advanced. Blocks must not be allocated or freed while the range is in use.
+  */
+  template <typename T, typename Layout>
+  class ObjectRange
+  {
+  public:
+    // Iterator over the objects of a range.
+    class Iterator
+    {
+    public:
+      typedef std::input_iterator_tag iterator_category;
+      typedef T                       value_type;
+      typedef std::ptrdiff_t          difference_type;
+      typedef T *                     pointer;
+      typedef T &                     reference;
+
+      // Constructor. A null range makes the end iterator.
+      explicit Iterator(ObjectRange * range) : range(range) {}
+
+      T & operator*() const { return *range->current; }
+      T * operator->() const { return range->current; }
+      Iterator & operator++() { range->Advance(); return *this; }
+      bool operator==(Iterator const & rhs) const { return AtEnd() == rhs.AtEnd(); }
+      bool operator!=(Iterator const & rhs) const { return AtEnd() != rhs.AtEnd(); }
+
+    private:
+      // Checks whether the iterator has passed the last object.
+      bool AtEnd() const { return range == nullptr || range->current == nullptr; }
+
+      // The range being iterated.
+      ObjectRange * range;
+    };
+
+    // Constructor. Finds the first object.
+    explicit ObjectRange(ObjectAllocator<T, Layout> & allocator);
+
+    Iterator begin() { return Iterator(this); }
+    Iterator end() { return Iterator(nullptr); }
+
+  private:
+    // Moves to the next object, or sets current to null after the last one.
+    void Advance();
+
+    // Loads the occupancy of the current page, skipping empty pages.
+    void LoadPage();
+
+    // The allocator being iterated.
+    ObjectAllocator<T, Layout> &        allocator;
+
+    // Current page.
+    PageHeader *                page;
+
+    // Occupancy of the current page.
+    std::uint64_t const *       occupancy;
+
+    // Current word of the occupancy.
+    unsigned                    word;
+
+    // Objects of the current word not visited yet.
+    std::uint64_t               bits;
+
+    // Current object.
+    T *                         current;
+
+    // Occupancy of the current page when it is not the page's bitmap.
+    std::vector<std::uint64_t>  scratch;
+  };
+
+  template <typename T, typename Layout>
+  ObjectRange<T, Layout>::ObjectRange(ObjectAllocator<T, Layout> & allocator) :
+    allocator(allocator),
+    page(allocator.pageList),
+    occupancy(nullptr),
+    word(0),
+    bits(0),
+    current(nullptr),
+    scratch(allocator.GetOccupancyWords())
+  {
+    LoadPage();
+    Advance();
+  }
+
+  template <typename T, typename Layout>
+  void ObjectRange<T, Layout>::Advance()
+  {
+    while (bits == 0)
+    {
+      if (page == nullptr)
+      {
+        current = nullptr;
+        return;
+      }
+
+      if (++word < allocator.GetOccupancyWords())
+      {
+        bits = allocator.GetOccupancyWord(occupancy, word);
+      }
+      else
+      {
+        page = page->next;
+        LoadPage();
+      }
+    }
+
+    unsigned bit = CountTrailingZeros(bits);
+    bits &= bits - 1;
+    current = reinterpret_cast<T*>(allocator.GetBlock(page, word * 64 + bit));
+  }
+
+  template <typename T, typename Layout>
+  void ObjectRange<T, Layout>::LoadPage()
+  {
+    while (page != nullptr && page->liveBlocks == 0)
+    {
+      page = page->next;
+    }
+
+    if (page != nullptr)
+    {
+      occupancy = allocator.GetOccupancy(page, scratch.data());
+      word = 0;
+      bits = allocator.GetOccupancyWord(occupancy, 0);
+    }
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T, typename Layout>
+  ObjectAllocator<T, Layout>::ObjectAllocator(char const * logFile, ObjectAllocatorSettings settings)
+    : ObjectAllocator(new std::ofstream(), settings)
+  {
+    ownsLogStream = true;
+    ((std::ofstream*)logStream)->open(logFile);
+  }
+
+  template <typename T, typename Layout>
+  ObjectAllocator<T, Layout>::ObjectAllocator(std::ostream * logStream, ObjectAllocatorSettings settings) :
+#else
+  template <typename T, typename Layout>
+  ObjectAllocator<T, Layout>::ObjectAllocator(ObjectAllocatorSettings settings) :
+#endif
+    settings(settings),
+    pageList(nullptr),
+    pageTail(nullptr),
+    emptyPages(0),
+    growthPages(1),
+    layout(settings)
+  {
+    if (this->settings.pageSource == nullptr)
+    {
+      this->settings.pageSource = &HeapPageSource::Instance();
+    }
+
+#ifdef MEMORYMANAGER_DEBUG
+    this->logStream = logStream;
+    ownsLogStream = false;
+#endif
+  }
+
+  // Destructor
+  template <typename T, typename Layout>
+  ObjectAllocator<T, Layout>::~ObjectAllocator()
+  {
+#ifdef MEMORYMANAGER_DEBUG
+    if (logStream != nullptr)
+    {
+      DumpMemoryInUse(*logStream);
+    }
+#endif
+    while (pageList)
+    {
+      ReleasePage(pageList);
+    }
+#ifdef MEMORYMANAGER_DEBUG
+    if (ownsLogStream && logStream != nullptr)
+    {
+      delete logStream;
+    }
+#endif
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T, typename Layout>
+  void * ObjectAllocator<T, Layout>::Allocate(const char * file, unsigned line)
+  {
+    //Pop the top off the free list
+    char * p = reinterpret_cast<char*>(PopBlock());
+    PrepareBlock(p, file, line);
+    CountAllocations(1);
+
+    return (void*)p;
+  }
+
+  template <typename T, typename Layout>
+  unsigned char ObjectAllocator<T, Layout>::Free(void * mem, char const * filename, unsigned line)
+  {
+    unsigned char errorCode = ValidateFree(mem, filename, line);
+    if (errorCode != 0)
+    {
+      return errorCode;
+    }
+
+    static_cast<T *>(mem)->~T();
+    ClearBlock(mem);
+    CountDeallocations(1);
+
+    //Add object to free list
+    PushBlock(reinterpret_cast<GenericObject*>(mem));
+    return 0;
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::PrepareBlock(char * p, char const * file, unsigned line) const
+  {
+    memset(p, ALLOCATED, layout.blockSize);
+
+    //Set the debug header
+    DebugHeader * dbg = reinterpret_cast<DebugHeader*>(p - headerSize - layout.padBytes);
+    dbg->allocated = true;
+    dbg->line = line;
+    dbg->filename = file;
+    dbg->runBlocks = 0;
+  }
+
+  template <typename T, typename Layout>
+  unsigned char ObjectAllocator<T, Layout>::ValidateFree(void * mem, char const * filename, unsigned line) const
+  {
+    return ValidateFree(mem, layout.blockSize, 0, filename, line);
+  }
+
+  template <typename T, typename Layout>
+  unsigned char ObjectAllocator<T, Layout>::ValidateFree(void * mem, std::size_t size, unsigned runBlocks, char const * filename, unsigned line) const
+  {
+    DebugHeader const * header = GetDebugHeader(mem);
+    unsigned char * del = static_cast<unsigned char*>(mem);
+
+    //Check for valid memory address. Only pages in the index are safe to look at
+    PageHeader const * page = GetPage(mem);
+    if (pageIndex.find(page) == pageIndex.end())
+    {
+      if (logStream != nullptr)
+      {
+        *logStream << "Attempt to free memory not owned by the allocator from #" << line << " in file " << filename << std::endl;
+      }
+#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
+      throw MemoryManagerException("Attempt to free memory not owned by the allocator.", filename, line);
+#endif
+      return UNALLOCATED;
+    }
+
+    //Page found. Check the alignment of pointer
+    std::uintptr_t d = reinterpret_cast<std::uintptr_t>(del) - reinterpret_cast<std::uintptr_t>(page);
+    std::uintptr_t left_offset = layout.leftChunkSize - layout.padBytes - layout.blockSize;
+    if (d < left_offset || ((d - left_offset) % layout.interChunkSize) != 0 || (d - left_offset) / layout.interChunkSize >= layout.blocksPerPage)
+    {
+      if (logStream != nullptr)
+      {
+        *logStream << "Invalid alignment on free from #" << line << " in file " << filename << std::endl;
+      }
+
+#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
+      throw MemoryManagerException("Invalid alignment on free.", filename, line);
+#endif
+      return ALIGN;
+    }
+
+    //Location is valid, check flags
+    if (!header->allocated)
+    {
+      if (logStream != nullptr)
+      {
+        *logStream << "Attempt to free already freed memory from #" << line << " in file " << filename << std::endl;
+      }
+#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
+      throw MemoryManagerException("Attempt to free already freed memory.", filename, line);
+#endif
+      return FREED;
+    }
+
+    //Arrays must be freed with FreeArray and the count they were allocated with
+    if (header->runBlocks != runBlocks)
+    {
+      if (logStream != nullptr)
+      {
+        *logStream << "Free does not match allocation at #" << header->line << " in file " << header->filename << " from #" << line << " in file " << filename << std::endl;
+      }
+#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
+      throw MemoryManagerException("Free does not match allocation.", filename, line);
+#endif
+      return MISMATCH;
+    }
+
+    //Check if object invalidated pad bytes
+    unsigned char * pad_left = reinterpret_cast<unsigned char*>(del - 1), *pad_right = reinterpret_cast<unsigned char*>(del + size);
+    for (unsigned i = 0; i < layout.padBytes; ++i, --pad_left, ++pad_right)
+    {
+      if (*pad_left != PAD || *pad_right != PAD)
+      {
+        if (logStream != nullptr)
+        {
+          *logStream << "Pad bytes invalidated for object allocated at #" << header->line << " in file " << header->filename << std::endl;
+        }
+#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
+        throw MemoryManagerException("Pad bytes invalidated for object.", filename, line);
+#endif
+        return PAD;
+      }
+    }
+
+    return 0;
+  }
+
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::ClearBlock(void * mem) const
+  {
+    //Set the freed signature
+    memset(static_cast<unsigned char*>(mem), FREED, layout.blockSize);
+    //Clear the header
+    memset(static_cast<unsigned char *>(mem) - headerSize - layout.padBytes, 0, headerSize);
+  }
+
+  template <typename T, typename Layout>
+  void * ObjectAllocator<T, Layout>::AllocateArray(unsigned count, const char * file, unsigned line)
+  {
+    unsigned blocks = GetRunBlocks(count);
+    if (count == 0)
+    {
+      return nullptr;
+    }
+    if (blocks > layout.blocksPerPage)
+    {
+      return ::operator new(std::size_t(count) * sizeof(T), std::align_val_t(layout.alignment));
+    }
+
+    char * p = reinterpret_cast<char*>(TakeRun(blocks));
+    std::size_t size = std::size_t(count) * sizeof(T);
+    memset(p, ALLOCATED, size);
+
+    //The right pad bytes follow the array instead of the first block
+    memset(p + size, PAD, layout.padBytes);
+
+    DebugHeader * dbg = reinterpret_cast<DebugHeader*>(p - headerSize - layout.padBytes);
+    dbg->allocated = true;
+    dbg->line = line;
+    dbg->filename = file;
+    dbg->runBlocks = blocks;
+    CountArrayAllocation(blocks);
+    return p;
+  }
+
+  template <typename T, typename Layout>
+  unsigned char ObjectAllocator<T, Layout>::FreeArray(T * objects, unsigned count, char const * filename, unsigned line)
+  {
+    unsigned blocks = GetRunBlocks(count);
+    if (objects == nullptr)
+    {
+      return 0;
+    }
+    if (blocks > layout.blocksPerPage)
+    {
+      for (unsigned i = 0; i < count; ++i)
+      {
+        objects[i].~T();
+      }
+      ::operator delete(objects, std::align_val_t(layout.alignment));
+      return 0;
+    }
+
+    unsigned char errorCode = ValidateFree(objects, std::size_t(count) * sizeof(T), blocks, filename, line);
+    if (errorCode != 0)
+    {
+      return errorCode;
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+      objects[i].~T();
+    }
+    ClearRun(objects, blocks);
+    CountArrayDeallocation(blocks);
+    GiveRun(reinterpret_cast<GenericObject*>(objects), blocks);
+    return 0;
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::LayOutPage(PageHeader * page) const
+  {
+    char * p = reinterpret_cast<char*>(page);
+
+    //Move past page header and bitmap
+    p += layout.pageHeaderSize;
+
+    //Set align signature
+    memset(p, ALIGN, layout.leftAlign);
+    //Most past left alignment
+    p += layout.leftAlign;
+
+    //Zero header block
+    memset(p, 0, headerSize);
+    //Move past header
+    p += headerSize;
+
+    //Set pad signature
+    memset(p, PAD, layout.padBytes);
+    //Move past pad bits
+    p += layout.padBytes;
+
+    //Set signatures for every block except for last block
+    for (unsigned i = 0; i < layout.blocksPerPage - 1; ++i)
+    {
+      //Set unallocated signature and move past block
+      memset(p, UNALLOCATED, layout.blockSize);
+      p += layout.blockSize;
+
+      //Set padding signature
+      memset(p, PAD, layout.padBytes);
+      //Move past pad bits
+      p += layout.padBytes;
+
+      //Set alignment signature
+      memset(p, ALIGN, layout.interAlign);
+      //Move past align bits
+      p += layout.interAlign;
+
+      //Zero header block
+      memset(p, 0, headerSize);
+      //Move past header
+      p += headerSize;
+
+      //Set padding signature
+      memset(p, PAD, layout.padBytes);
+      //Move past pad bits
+      p += layout.padBytes;
+    }
+
+    //Set last block separately
+    memset(p, UNALLOCATED, layout.blockSize);
+    p += layout.blockSize;
+
+    //Set padding signature
+    memset(p, PAD, layout.padBytes);
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::ClearRun(void * first, unsigned blocks) const
+  {
+    //Lay out every block as AllocatePage does, since the array covered the debug bytes between them
+    unsigned char * p = static_cast<unsigned char *>(first);
+    for (unsigned i = 0; i < blocks; ++i)
+    {
+      memset(p - headerSize - layout.padBytes, 0, headerSize);
+      memset(p - layout.padBytes, PAD, layout.padBytes);
+      memset(p, FREED, layout.blockSize);
+      memset(p + layout.blockSize, PAD, layout.padBytes);
+      if (i + 1 < blocks)
+      {
+        memset(p + layout.blockSize + layout.padBytes, ALIGN, layout.interAlign);
+      }
+      p += layout.blockStride;
+    }
+  }
+#else
+  template <typename T, typename Layout>
+  void * ObjectAllocator<T, Layout>::Allocate()
+  {
+#ifdef MEMORYMANAGER_STATS
+    GenericObject * p = PopBlock();
+    CountAllocations(1);
+    return p;
+#else
+    // Pop object off free list and return
+    return PopBlock();
+#endif
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::Free(void * mem)
+  {
+    if (mem != nullptr)
+    {
+      static_cast<T *>(mem)->~T();
+#ifdef MEMORYMANAGER_STATS
+      CountDeallocations(1);
+#endif
+
+      //Add object to free list
+      PushBlock(reinterpret_cast<GenericObject*>(mem));
+    }
+  }
+
+  template <typename T, typename Layout>
+  void * ObjectAllocator<T, Layout>::AllocateArray(unsigned count)
+  {
+    unsigned blocks = GetRunBlocks(count);
+    if (count == 0)
+    {
+      return nullptr;
+    }
+    if (blocks > layout.blocksPerPage)
+    {
+      return ::operator new(std::size_t(count) * sizeof(T), std::align_val_t(layout.alignment));
+    }
+#ifdef MEMORYMANAGER_STATS
+    CountArrayAllocation(blocks);
+#endif
+    return TakeRun(blocks);
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::FreeArray(T * objects, unsigned count)
+  {
+    if (objects == nullptr)
+    {
+      return;
+    }
+    for (unsigned i = 0; i < count; ++i)
+    {
+      objects[i].~T();
+    }
+
+    unsigned blocks = GetRunBlocks(count);
+    if (blocks > layout.blocksPerPage)
+    {
+      ::operator delete(objects, std::align_val_t(layout.alignment));
+      return;
+    }
+#ifdef MEMORYMANAGER_STATS
+    CountArrayDeallocation(blocks);
+#endif
+    GiveRun(reinterpret_cast<GenericObject*>(objects), blocks);
+  }
+#endif
+
+  template <typename T, typename Layout>
+  GenericObject * ObjectAllocator<T, Layout>::AcquireBlocks(unsigned count, GenericObject * & tail)
+  {
+    GenericObject * head = TakeBlocks(count, tail, nullptr);
+
+#ifdef MEMORYMANAGER_STATS
+    stats.blocksInUse += count;
+#endif
+    return head;
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::ReleaseBlocks(GenericObject * head, GenericObject * tail, unsigned count)
+  {
+#ifdef MEMORYMANAGER_STATS
+    if (stats.blocksInUse > stats.mostBlocksInUse)
+    {
+      stats.mostBlocksInUse = stats.blocksInUse;
+    }
+    stats.blocksInUse -= count;
+#else
+    static_cast<void>(count);
+#endif
+
+    //Blocks may belong to different pages, so return them one at a time
+    while (head != nullptr)
+    {
+      GenericObject * next = head == tail ? nullptr : head->next;
+      PushBlock(head);
+      head = next;
+    }
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::AllocateBatch(unsigned count, T ** blocks, const char * file, unsigned line)
+  {
+    GenericObject * tail;
+    TakeBlocks(count, tail, blocks);
+    for (unsigned i = 0; i < count; ++i)
+    {
+      PrepareBlock(reinterpret_cast<char*>(blocks[i]), file, line);
+    }
+
+    //Update stats once for the whole batch
+    CountAllocations(count);
+  }
+
+  template <typename T, typename Layout>
+  unsigned char ObjectAllocator<T, Layout>::FreeBatch(T * const * objects, unsigned count, char const * file, unsigned line)
+  {
+    unsigned char firstError = 0;
+    unsigned freed = 0;
+    for (unsigned i = 0; i < count; ++i)
+    {
+      if (objects[i] == nullptr)
+      {
+        continue;
+      }
+
+      //Blocks are cleared as they are validated, so duplicates in the batch are caught
+      unsigned char errorCode = ValidateFree(objects[i], file, line);
+      if (errorCode != 0)
+      {
+        if (firstError == 0)
+        {
+          firstError = errorCode;
+        }
+        continue;
+      }
+
+      objects[i]->~T();
+      ClearBlock(objects[i]);
+      PushBlock(reinterpret_cast<GenericObject*>(objects[i]));
+      ++freed;
+    }
+
+    //Update stats once for the whole batch
+    CountDeallocations(freed);
+    return firstError;
+  }
+#else
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::AllocateBatch(unsigned count, T ** blocks)
+  {
+    GenericObject * tail;
+    TakeBlocks(count, tail, blocks);
+#ifdef MEMORYMANAGER_STATS
+    CountAllocations(count);
+#endif
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::FreeBatch(T * const * objects, unsigned count)
+  {
+#ifdef MEMORYMANAGER_STATS
+    unsigned freed = 0;
+#endif
+    for (unsigned i = 0; i < count; ++i)
+    {
+      if (objects[i] != nullptr)
+      {
+        objects[i]->~T();
+#ifdef MEMORYMANAGER_STATS
+        ++freed;
+#endif
+      }
+    }
+#ifdef MEMORYMANAGER_STATS
+    CountDeallocations(freed);
+#endif
+    GiveBlocks(objects, count);
+  }
+#endif
+
+  template <typename T, typename Layout>
+  GenericObject * ObjectAllocator<T, Layout>::TakeBlocks(unsigned count, GenericObject * & tail, T ** blocks)
+  {
+    //Create every page the batch needs up front, behind the pages with free blocks
+    Reserve(count);
+
+    GenericObject * head = nullptr;
+    tail = nullptr;
+    unsigned taken = 0;
+    while (taken < count)
+    {
+      PageHeader * page = pageList;
+      assert(page != nullptr && HasFreeBlocks(page));
+
+      GenericObject * first;
+      GenericObject * last;
+      unsigned run = 1;
+      if (layout.bitmapWords != 0)
+      {
+        //Blocks may be smaller than a pointer, so they are only chained when no array is given
+        first = TakeBitmapBlock(page);
+        last = first;
+        if (blocks != nullptr)
+        {
+          blocks[taken] = reinterpret_cast<T*>(first);
+        }
+        while (taken + run < count && page->liveBlocks + run < layout.blocksPerPage)
+        {
+          GenericObject * block = TakeBitmapBlock(page);
+          if (blocks != nullptr)
+          {
+            blocks[taken + run] = reinterpret_cast<T*>(block);
+          }
+          else
+          {
+            last->next = block;
+          }
+          last = block;
+          ++run;
+        }
+      }
+      else if (page->freeList != nullptr)
+      {
+        //Cut a run off the front of the page's free list
+        first = page->freeList;
+        last = first;
+        if (blocks != nullptr)
+        {
+          blocks[taken] = reinterpret_cast<T*>(first);
+        }
+        while (taken + run < count && last->next != nullptr)
+        {
+          last = last->next;
+          if (blocks != nullptr)
+          {
+            blocks[taken + run] = reinterpret_cast<T*>(last);
+          }
+          ++run;
+        }
+        page->freeList = last->next;
+        last->next = nullptr;
+      }
+      else
+      {
+        //Chain a run of never used blocks in address order
+        first = GetBlock(page, page->bumpIndex++);
+        last = first;
+        if (blocks != nullptr)
+        {
+          blocks[taken] = reinterpret_cast<T*>(first);
+        }
+        while (taken + run < count && page->bumpIndex < layout.blocksPerPage)
+        {
+          last->next = GetBlock(page, page->bumpIndex++);
+          last = last->next;
+          if (blocks != nullptr)
+          {
+            blocks[taken + run] = reinterpret_cast<T*>(last);
+          }
+          ++run;
+        }
+        last->next = nullptr;
+      }
+
+      if (page->liveBlocks == 0)
+      {
+        --emptyPages;
+      }
+      page->liveBlocks += run;
+
+      if (!HasFreeBlocks(page))
+      {
+        OnPageFull(page);
+      }
+
+      //Append the run to the chain
+      if (tail != nullptr && (blocks == nullptr || layout.bitmapWords == 0))
+      {
+        tail->next = first;
+      }
+      else
+      {
+        head = first;
+      }
+      tail = last;
+      taken += run;
+    }
+    return head;
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::GiveBlocks(T * const * objects, unsigned count)
+  {
+    if (layout.bitmapWords != 0)
+    {
+      //Freeing is a bit clear, so there are no runs to splice
+      for (unsigned i = 0; i < count; ++i)
+      {
+        if (objects[i] != nullptr)
+        {
+          PushBlock(reinterpret_cast<GenericObject*>(objects[i]));
+        }
+      }
+      return;
+    }
+
+    unsigned i = 0;
+    while (i < count)
+    {
+      if (objects[i] == nullptr)
+      {
+        ++i;
+        continue;
+      }
+
+      //Chain together the run of objects that share a page
+      PageHeader * page = GetPage(objects[i]);
+      GenericObject * first = reinterpret_cast<GenericObject*>(objects[i]);
+      GenericObject * last = first;
+      unsigned run = 1;
+      for (++i; i < count && objects[i] != nullptr && GetPage(objects[i]) == page; ++i, ++run)
+      {
+        last->next = reinterpret_cast<GenericObject*>(objects[i]);
+        last = last->next;
+      }
+
+      if (!HasFreeBlocks(page))
+      {
+        OnPageOpened(page);
+      }
+      PushChain(page->freeList, first, last);
+
+      page->liveBlocks -= run;
+      if (page->liveBlocks == 0)
+      {
+        OnPageEmptied(page);
+      }
+    }
+  }
+
+  template <typename T, typename Layout>
+  unsigned ObjectAllocator<T, Layout>::Trim(unsigned maxEmptyPages)
+  {
+    unsigned released = 0;
+
+    //Pages with free blocks are at the front of the list
+    PageHeader * page = pageList;
+    while (page != nullptr && HasFreeBlocks(page) && emptyPages > maxEmptyPages)
+    {
+      PageHeader * next = page->next;
+      if (page->liveBlocks == 0)
+      {
+        ReleasePage(page);
+        ++released;
+      }
+      page = next;
+    }
+    return released;
+  }
+
+  template <typename T, typename Layout>
+  unsigned ObjectAllocator<T, Layout>::Reserve(unsigned count)
+  {
+    //Pages with free blocks are at the front of the list. Stop once they hold enough
+    std::size_t freeBlocks = 0;
+    PageHeader * last = nullptr;
+    for (PageHeader * page = pageList; page != nullptr && HasFreeBlocks(page) && freeBlocks < count; page = page->next)
+    {
+      freeBlocks += layout.blocksPerPage - page->liveBlocks;
+      last = page;
+    }
+
+    //New pages go behind the pages with free blocks, so those are used first
+    unsigned created = 0;
+    while (freeBlocks < count)
+    {
+      last = CreatePage(last);
+      freeBlocks += layout.blocksPerPage;
+      ++created;
+    }
+    return created;
+  }
+
+#ifdef MEMORYMANAGER_STATS
+  template <typename T, typename Layout>
+  Stats ObjectAllocator<T, Layout>::GetStats() const
+  {
+    Stats result = stats;
+    result.freeBlocks = stats.pagesInUse * layout.blocksPerPage - stats.blocksInUse;
+    if (result.blocksInUse > result.mostBlocksInUse)
+    {
+      result.mostBlocksInUse = result.blocksInUse;
+    }
+    return result;
+  }
+#endif
+
+  template <typename T, typename Layout>
+  template <typename Function>
+  void ObjectAllocator<T, Layout>::ForEach(Function && function)
+  {
+    std::vector<std::uint64_t> scratch(GetOccupancyWords());
+    for (PageHeader * page = pageList; page != nullptr; page = page->next)
+    {
+      VisitPage(page, scratch.data(), function);
+    }
+  }
+
+  template <typename T, typename Layout>
+  template <typename Function>
+  void ObjectAllocator<T, Layout>::ForEach(Function && function, unsigned part, unsigned parts)
+  {
+    assert(parts > 0 && part < parts);
+    unsigned pageCount = 0;
+    for (PageHeader * page = pageList; page != nullptr; page = page->next)
+    {
+      ++pageCount;
+    }
+
+    //Find the pages of this part
+    unsigned first = static_cast<unsigned>(std::uint64_t(pageCount) * part / parts);
+    unsigned last = static_cast<unsigned>(std::uint64_t(pageCount) * (part + 1) / parts);
+    PageHeader * page = pageList;
+    for (unsigned i = 0; i < first; ++i)
+    {
+      page = page->next;
+    }
+
+    std::vector<std::uint64_t> scratch(GetOccupancyWords());
+    for (unsigned i = first; i < last; ++i)
+    {
+      VisitPage(page, scratch.data(), function);
+      page = page->next;
+    }
+  }
+
+  template <typename T, typename Layout>
+  template <typename Function>
+  void ObjectAllocator<T, Layout>::ParallelForEach(Function && function, unsigned threads)
+  {
+    if (threads < 2)
+    {
+      ForEach(function);
+      return;
+    }
+
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    for (unsigned part = 1; part < threads; ++part)
+    {
+      workers.emplace_back([this, &function, part, threads]() { ForEach(function, part, threads); });
+    }
+    ForEach(function, 0, threads);
+    for (std::thread & worker : workers)
+    {
+      worker.join();
+    }
+  }
+
+  template <typename T, typename Layout>
+  ObjectRange<T, Layout> ObjectAllocator<T, Layout>::Objects()
+  {
+    return ObjectRange<T, Layout>(*this);
+  }
+
+  template <typename T, typename Layout>
+  template <typename Relocate>
+  unsigned ObjectAllocator<T, Layout>::Compact(Relocate && relocate)
+  {
+    //Pages with blocks in use and free blocks, fullest first
+    std::vector<PageHeader *> pages;
+    for (PageHeader * page = pageList; page != nullptr && HasFreeBlocks(page); page = page->next)
+    {
+      if (page->liveBlocks != 0)
+      {
+        pages.push_back(page);
+      }
+    }
+    std::sort(pages.begin(), pages.end(), [](PageHeader const * lhs, PageHeader const * rhs)
+    {
+      return lhs->liveBlocks != rhs->liveBlocks ? lhs->liveBlocks > rhs->liveBlocks : lhs < rhs;
+    });
+
+    //Empty the emptiest pages into the fullest until they meet
+    std::vector<std::uint64_t> occupancy(GetOccupancyWords());
+    unsigned released = 0;
+    std::size_t target = 0;
+    std::size_t source = pages.size();
+    while (target + 1 < source)
+    {
+      PageHeader * page = pages[--source];
+
+      //Copy the occupancy, since the bitmap changes as blocks move
+      std::uint64_t const * current = GetOccupancy(page, occupancy.data());
+      if (current != occupancy.data())
+      {
+        memcpy(occupancy.data(), current, occupancy.size() * sizeof(std::uint64_t));
+      }
+
+      for (unsigned word = 0; word < occupancy.size() && target < source; ++word)
+      {
+        std::uint64_t bits = GetOccupancyWord(occupancy.data(), word);
+        while (bits != 0)
+        {
+          while (target < source && !HasFreeBlocks(pages[target]))
+          {
+            ++target;
+          }
+          if (target == source)
+          {
+            break;
+          }
+
+          unsigned bit = CountTrailingZeros(bits);
+          bits &= bits - 1;
+          GenericObject * from = GetBlock(page, word * 64 + bit);
+          GenericObject * to = TakeBlock(pages[target]);
+#ifdef MEMORYMANAGER_DEBUG
+          DebugHeader const * dbg = GetDebugHeader(from);
+          PrepareBlock(reinterpret_cast<char*>(to), dbg->filename, dbg->line);
+#endif
+          if (!relocate(reinterpret_cast<T*>(from), reinterpret_cast<T*>(to)))
+          {
+            //Leave the object where it is
+            std::swap(from, to);
+          }
+#ifdef MEMORYMANAGER_DEBUG
+          ClearBlock(from);
+#endif
+
+          //Return the block without releasing its page while the page is still being read
+          PageHeader * owner = GetPage(from);
+          if (!HasFreeBlocks(owner))
+          {
+            OnPageOpened(owner);
+          }
+          if (layout.bitmapWords != 0)
+          {
+            GiveBitmapBlock(owner, from);
+          }
+          else
+          {
+            Push(owner->freeList, from);
+          }
+          if (--owner->liveBlocks == 0)
+          {
+            ++emptyPages;
+            RewindPage(owner);
+          }
+        }
+      }
+
+      if (page->liveBlocks == 0)
+      {
+        ReleasePage(page);
+        ++released;
+      }
+    }
+    return released;
+  }
+
+  template <typename T, typename Layout>
+  std::uint64_t const * ObjectAllocator<T, Layout>::GetOccupancy(PageHeader * page, std::uint64_t * scratch) const
+  {
+    unsigned words = GetOccupancyWords();
+    if (layout.bitmapWords != 0)
+    {
+      if (page->arrays == nullptr)
+      {
+        return GetBitmap(page);
+      }
+      memcpy(scratch, GetBitmap(page), words * sizeof(std::uint64_t));
+    }
+    else
+    {
+      //Blocks below the bump index were handed out, unless they are on the free list
+      GetListOccupancy(page, scratch);
+    }
+
+    //Blocks of arrays are not objects of their own
+    if (page->arrays != nullptr)
+    {
+      for (unsigned i = 0; i < words; ++i)
+      {
+        scratch[i] &= ~page->arrays[i];
+      }
+    }
+    return scratch;
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::GetListOccupancy(PageHeader * page, std::uint64_t * scratch) const
+  {
+    unsigned words = GetOccupancyWords();
+    unsigned fullWords = page->bumpIndex / 64;
+    for (unsigned i = 0; i < words; ++i)
+    {
+      scratch[i] = i < fullWords ? ~std::uint64_t(0) : 0;
+    }
+    if (page->bumpIndex % 64 != 0)
+    {
+      scratch[fullWords] = (std::uint64_t(1) << (page->bumpIndex % 64)) - 1;
+    }
+    for (GenericObject * block = page->freeList; block != nullptr; block = block->next)
+    {
+      unsigned index = GetBlockIndex(page, block);
+      scratch[index / 64] &= ~(std::uint64_t(1) << (index % 64));
+    }
+  }
+
+  template <typename T, typename Layout>
+  template <typename Function>
+  void ObjectAllocator<T, Layout>::VisitPage(PageHeader * page, std::uint64_t * scratch, Function & function)
+  {
+    if (page->liveBlocks == 0)
+    {
+      return;
+    }
+
+    //Full pages without arrays need no occupancy
+    if (page->liveBlocks == layout.blocksPerPage && page->arrays == nullptr)
+    {
+      for (unsigned i = 0; i < layout.blocksPerPage; ++i)
+      {
+        function(*reinterpret_cast<T*>(GetBlock(page, i)));
+      }
+      return;
+    }
+
+    std::uint64_t const * occupancy = GetOccupancy(page, scratch);
+    unsigned words = GetOccupancyWords();
+    for (unsigned word = 0; word < words; ++word)
+    {
+      std::uint64_t bits = GetOccupancyWord(occupancy, word);
+      while (bits != 0)
+      {
+        unsigned bit = CountTrailingZeros(bits);
+        bits &= bits - 1;
+        function(*reinterpret_cast<T*>(GetBlock(page, word * 64 + bit)));
+      }
+    }
+  }
+
+  template <typename T, typename Layout>
+  GenericObject * ObjectAllocator<T, Layout>::PopBlock()
+  {
+    PageHeader * page = pageList;
+    if (page == nullptr || !HasFreeBlocks(page))
+    {
+      page = Grow();
+    }
+    return TakeBlock(page);
+  }
+
+  template <typename T, typename Layout>
+  GenericObject * ObjectAllocator<T, Layout>::TakeBlock(PageHeader * page)
+  {
+    GenericObject * p;
+    if (layout.bitmapWords != 0)
+    {
+      p = TakeBitmapBlock(page);
+    }
+    else if (page->freeList != nullptr)
+    {
+      p = Pop(page->freeList);
+
+      //The next allocation reads this block's next pointer
+      MEMORYMANAGER_PREFETCH(page->freeList);
+    }
+    else
     {
-      //Determine if address lies in current block
-      unsigned int d = reinterpret_cast<unsigned int>(del) - reinterpret_cast<unsigned int>(pages);
-      if (d < pageSize)
-      {
-        unsigned left_offset = leftChunkSize - settings.padBytes - blockSize;
-        //Page found. Check the alignment of pointer
-        if (((d - left_offset) % interChunkSize) != 0)
-        {
-          if (logStream != nullptr)
-          {
-            *logStream << "Invalid alignment on free from #" << line << " in file " << filename << std::endl;
-          }
+      //Hand out never used blocks in address order
+      p = GetBlock(page, page->bumpIndex++);
+    }
 
-#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
-          throw MemoryManagerException("Invalid alignment on free.", filename, line);
-#endif
-          return ALIGN;
-        }
-        else //Location is valid, check flags
-        {
-          if (!header->allocated)
-          {
-            if (logStream != nullptr)
-            {
-              *logStream << "Attempt to free already freed memory from #" << line << " in file " << filename << std::endl;
-            }
-#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
-            throw MemoryManagerException("Attempt to free already freed memory.", filename, line);
-#endif
-            return FREED;
-          }
+    if (page->liveBlocks++ == 0)
+    {
+      --emptyPages;
+    }
 
-          //Check if object invalidated pad bytes
-          unsigned char * pad_left = reinterpret_cast<unsigned char*>(del - 1), *pad_right = reinterpret_cast<unsigned char*>(del + blockSize);
-          for (unsigned i = 0; i < settings.padBytes; ++i, --pad_left, ++pad_right)
-          {
-            if (*pad_left != PAD || *pad_right != PAD)
-            {
-              if (logStream != nullptr)
-              {
-                *logStream << "Pad bytes invalidated for object allocated at #" << header->line << " in file " << header->filename << std::endl;
-              }
-#ifdef MEMORYMANAGER_ENABLE_EXCEPTIONS
-              throw MemoryManagerException("Pad bytes invalidated for object.", filename, line);
+    if (!HasFreeBlocks(page))
+    {
+      OnPageFull(page);
+    }
+    return p;
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::PushBlock(GenericObject * block)
+  {
+    PageHeader * page = GetPage(block);
+    if (!HasFreeBlocks(page))
+    {
+      OnPageOpened(page);
+    }
+
+    if (layout.bitmapWords != 0)
+    {
+      GiveBitmapBlock(page, block);
+    }
+    else
+    {
+      Push(page->freeList, block);
+    }
+
+    if (--page->liveBlocks == 0)
+    {
+      OnPageEmptied(page);
+    }
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::RewindPage(PageHeader * page)
+  {
+    //Freed blocks are scattered on the free list. With none in use the whole page is never used blocks again
+    if (layout.bitmapWords == 0)
+    {
+      page->freeList = nullptr;
+      page->bumpIndex = 0;
+    }
+#ifdef MEMORYMANAGER_DEBUG
+    LayOutPage(page);
 #endif
-              return PAD;
-            }
-          }
-        }
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::OnPageEmptied(PageHeader * page)
+  {
+    ++emptyPages;
+    if (emptyPages > settings.maxEmptyPages)
+    {
+      ReleasePage(page);
+    }
+    else
+    {
+      RewindPage(page);
+    }
+  }
+
+  template <typename T, typename Layout>
+  unsigned ObjectAllocator<T, Layout>::FindRun(PageHeader * page, unsigned count) const
+  {
+    if (layout.bitmapWords == 0)
+    {
+      //Freed blocks are scattered on the free list, so runs only come from never used blocks. Pages are rewound when they empty
+      return page->bumpIndex + count <= layout.blocksPerPage ? page->bumpIndex : layout.blocksPerPage;
+    }
 
-        //Checks successful. Break out
-        pages = nullptr;
+    std::uint64_t const * bitmap = GetBitmap(page);
+    unsigned run = 0;
+    for (unsigned index = page->freeWord * 64; index < layout.blocksPerPage; ++index)
+    {
+      std::uint64_t word = bitmap[index / 64];
+      if (word == ~std::uint64_t(0))
+      {
+        //Skip full words
+        run = 0;
+        index |= 63;
       }
-      else
+      else if (word & (std::uint64_t(1) << (index % 64)))
       {
-        pages = pages->next;
+        run = 0;
+      }
+      else if (++run == count)
+      {
+        return index + 1 - count;
       }
     }
+    return layout.blocksPerPage;
+  }
 
-    static_cast<T *>(mem)->~T();
+  template <typename T, typename Layout>
+  GenericObject * ObjectAllocator<T, Layout>::TakeRun(unsigned count)
+  {
+    //Pages with free blocks are at the front of the list
+    PageHeader * page = pageList;
+    unsigned index = layout.blocksPerPage;
+    for (; page != nullptr && HasFreeBlocks(page); page = page->next)
+    {
+      index = FindRun(page, count);
+      if (index != layout.blocksPerPage)
+      {
+        break;
+      }
+    }
+    if (index == layout.blocksPerPage)
+    {
+      page = Grow();
+      index = 0;
+    }
 
-    //Set the freed signature
-    memset(static_cast<unsigned char*>(mem), FREED, blockSize);
-    //Clear the header
-    memset(static_cast<unsigned char *>(mem) - headerSize - settings.padBytes, 0, headerSize);
+    if (layout.bitmapWords != 0)
+    {
+      std::uint64_t * bitmap = GetBitmap(page);
+      for (unsigned i = index; i < index + count; ++i)
+      {
+        bitmap[i / 64] |= std::uint64_t(1) << (i % 64);
+      }
+      if (bitmap[page->freeWord] == ~std::uint64_t(0))
+      {
+        page->freeWord = page->liveBlocks + count < layout.blocksPerPage ? FindWordWithClearBit(bitmap, layout.bitmapWords, page->freeWord + 1) : layout.bitmapWords;
+      }
+    }
+    else
+    {
+      page->bumpIndex = index + count;
+    }
 
-    //Add object to free list
-    Push(freeList, reinterpret_cast<GenericObject*>(mem));
+    //Mark the blocks as an array so they are not visited as objects
+    if (page->arrays == nullptr)
+    {
+      page->arrays = new std::uint64_t[GetOccupancyWords()]();
+    }
+    for (unsigned i = index; i < index + count; ++i)
+    {
+      page->arrays[i / 64] |= std::uint64_t(1) << (i % 64);
+    }
 
-    //Update stats
-    ++stats.deallocations;
-    --stats.blocksInUse;
-    ++stats.freeBlocks;
-    return 0;
+    if (page->liveBlocks == 0)
+    {
+      --emptyPages;
+    }
+    page->liveBlocks += count;
+    if (!HasFreeBlocks(page))
+    {
+      OnPageFull(page);
+    }
+    return GetBlock(page, index);
   }
-#else
-  template <typename T>
-  void * ObjectAllocator<T>::Allocate()
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::GiveRun(GenericObject * first, unsigned count)
   {
-    //If no memory available
-    if (freeList == nullptr)
+    PageHeader * page = GetPage(first);
+    if (!HasFreeBlocks(page))
     {
-      CreatePage();
+      OnPageOpened(page);
     }
 
-    // Pop object off free list and return
-    return Pop(freeList);
+    unsigned index = GetBlockIndex(page, first);
+    bool arrays = false;
+    for (unsigned i = index; i < index + count; ++i)
+    {
+      page->arrays[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+    }
+    for (unsigned word = 0; word < GetOccupancyWords(); ++word)
+    {
+      arrays |= page->arrays[word] != 0;
+    }
+    if (!arrays)
+    {
+      delete[] page->arrays;
+      page->arrays = nullptr;
+    }
+
+    if (layout.bitmapWords != 0)
+    {
+      std::uint64_t * bitmap = GetBitmap(page);
+      for (unsigned i = index; i < index + count; ++i)
+      {
+        bitmap[i / 64] &= ~(std::uint64_t(1) << (i % 64));
+      }
+      if (index / 64 < page->freeWord)
+      {
+        page->freeWord = index / 64;
+      }
+    }
+    else
+    {
+      //Push in reverse so the blocks are reused in address order
+      for (unsigned i = index + count; i-- > index;)
+      {
+        Push(page->freeList, GetBlock(page, i));
+      }
+    }
+
+    page->liveBlocks -= count;
+    if (page->liveBlocks == 0)
+    {
+      OnPageEmptied(page);
+    }
   }
 
-  template <typename T>
-  void ObjectAllocator<T>::Free(void * mem)
+  template <typename T, typename Layout>
+  PageHeader * ObjectAllocator<T, Layout>::CreatePage(PageHeader * position)
   {
-    if (mem != nullptr)
+    PageHeader * page = AllocatePage();
+    page->liveBlocks = 0;
+    ++emptyPages;
+    if (position != nullptr)
     {
-      static_cast<T *>(mem)->~T();
+      LinkAfter(position, page);
+    }
+    else
+    {
+      LinkFront(page);
+    }
+    return page;
+  }
 
-      //Add object to free list
-      Push(freeList, reinterpret_cast<GenericObject*>(mem));
+  template <typename T, typename Layout>
+  PageHeader * ObjectAllocator<T, Layout>::Grow()
+  {
+    PageHeader * page = CreatePage();
+    PageHeader * last = page;
+    for (unsigned i = 1; i < growthPages; ++i)
+    {
+      last = CreatePage(last);
+    }
+
+    if (growthPages < settings.maxGrowthPages)
+    {
+      growthPages = std::min(growthPages * 2, settings.maxGrowthPages);
     }
+    return page;
   }
-#endif
 
-  template <typename T>
-  void ObjectAllocator<T>::CreatePage()
+  template <typename T, typename Layout>
+  GenericObject * ObjectAllocator<T, Layout>::CreatePage(GenericObject * & tail)
   {
-    char * p = nullptr;
-    p = new char[pageSize];
+    PageHeader * page = AllocatePage();
 
-    //Add page on to page list
-    Push(pageList, reinterpret_cast<GenericObject*>(p));
+    //Chain every block in address order
+    GenericObject * head = GetBlock(page, 0);
+    tail = head;
+    for (unsigned i = 1; i < layout.blocksPerPage; ++i)
+    {
+      tail->next = GetBlock(page, i);
+      tail = tail->next;
+    }
+    tail->next = nullptr;
 
-    //Add objects on to the free list
+    //All blocks are handed out, so the page is full
+    if (layout.bitmapWords != 0)
+    {
+      memset(GetBitmap(page), 0xFF, layout.bitmapWords * sizeof(std::uint64_t));
+      page->freeWord = layout.bitmapWords;
+    }
+    page->bumpIndex = layout.blocksPerPage;
+    page->liveBlocks = layout.blocksPerPage;
+    LinkBack(page);
+    return head;
+  }
 
-    //Move past GenericObject pointer
-    p += sizeof(GenericObject*);
+  template <typename T, typename Layout>
+  PageHeader * ObjectAllocator<T, Layout>::AllocatePage()
+  {
+    char * p = static_cast<char*>(settings.pageSource->AllocatePage(layout.pageSize, layout.pageAlignment));
+    if (p == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    PageHeader * page = reinterpret_cast<PageHeader*>(p);
 
-#ifdef MEMORYMANAGER_DEBUG
-    //Set align signature
-    memset(p, ALIGN, leftAlign);
-#endif
-    //Most past left alignment
-    p += leftAlign;
+    //Blocks are handed out from the bump index, so they need no free list
+    page->freeList = nullptr;
+    page->bumpIndex = 0;
+    page->freeWord = 0;
+    page->arrays = nullptr;
 
-    //Zero header block
-    memset(p, 0, headerSize);
-    //Move past header
-    p += headerSize;
+    if (layout.bitmapWords != 0)
+    {
+      //Bits past the last block are marked in use so they are never handed out
+      std::uint64_t * bitmap = GetBitmap(page);
+      memset(bitmap, 0, layout.bitmapWords * sizeof(std::uint64_t));
+      if (layout.blocksPerPage % 64 != 0)
+      {
+        bitmap[layout.bitmapWords - 1] = ~std::uint64_t(0) << (layout.blocksPerPage % 64);
+      }
+    }
 
 #ifdef MEMORYMANAGER_DEBUG
-    //Set pad signature
-    memset(p, PAD, settings.padBytes);
+    pageIndex.insert(page);
+    LayOutPage(page);
 #endif
-    //Move past pad bits
-    p += settings.padBytes;
 
-    //Populate the free list except for last block
-    for (unsigned i = 0; i < settings.blocksPerPage - 1; ++i)
+#ifdef MEMORYMANAGER_STATS
+    //Update stats
+    ++stats.pagesInUse;
+    if (stats.pagesInUse > stats.mostPagesInUse)
     {
-      //Block memory
-#ifdef MEMORYMANAGER_DEBUG
-      //Set unallocated signature
-      memset(p, UNALLOCATED, blockSize);
+      stats.mostPagesInUse = stats.pagesInUse;
+    }
 #endif
-      //Push onto free list and move past block
-      Push(freeList, reinterpret_cast<GenericObject*>(p));
-      p += blockSize;
+    return page;
+  }
 
-#ifdef MEMORYMANAGER_DEBUG
-      //Set padding signature
-      memset(p, PAD, settings.padBytes);
-#endif
-      //Move past pad bits
-      p += settings.padBytes;
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::ReleasePage(PageHeader * page)
+  {
+    if (page->liveBlocks == 0)
+    {
+      --emptyPages;
+    }
+    Unlink(page);
+
+    delete[] page->arrays;
 
 #ifdef MEMORYMANAGER_DEBUG
-      //Set alignment signature
-      memset(p, ALIGN, interAlign);
+    pageIndex.erase(page);
 #endif
-      //Move past align bits
-      p += interAlign;
+#ifdef MEMORYMANAGER_STATS
+    --stats.pagesInUse;
+#endif
+    settings.pageSource->ReleasePage(page, layout.pageSize, layout.pageAlignment);
+  }
 
-      //Zero header block
-      memset(p, 0, headerSize);
-      //Move past header
-      p += headerSize;
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::LinkFront(PageHeader * page)
+  {
+    page->prev = nullptr;
+    page->next = pageList;
+    if (pageList != nullptr)
+    {
+      pageList->prev = page;
+    }
+    else
+    {
+      pageTail = page;
+    }
+    pageList = page;
+  }
 
-#ifdef MEMORYMANAGER_DEBUG
-      //Set padding signature
-      memset(p, PAD, settings.padBytes);
-#endif
-      //Move past pad bits
-      p += settings.padBytes;
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::LinkBack(PageHeader * page)
+  {
+    page->next = nullptr;
+    page->prev = pageTail;
+    if (pageTail != nullptr)
+    {
+      pageTail->next = page;
     }
+    else
+    {
+      pageList = page;
+    }
+    pageTail = page;
+  }
 
-    //Add last object separately
-    //Block memory
-#ifdef MEMORYMANAGER_DEBUG
-    //Set unallocated signature
-    memset(p, UNALLOCATED, blockSize);
-#endif
-    //Push onto free list and move past block
-    Push(freeList, reinterpret_cast<GenericObject*>(p));
-    p += blockSize;
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::LinkAfter(PageHeader * position, PageHeader * page)
+  {
+    page->prev = position;
+    page->next = position->next;
+    if (position->next != nullptr)
+    {
+      position->next->prev = page;
+    }
+    else
+    {
+      pageTail = page;
+    }
+    position->next = page;
+  }
 
-#ifdef MEMORYMANAGER_DEBUG
-    //Set padding signature
-    memset(p, PAD, settings.padBytes);
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::OnPageFull(PageHeader * page)
+  {
+    //Keep full pages behind pages with free blocks
+    if (page != pageTail)
+    {
+      Unlink(page);
+      LinkBack(page);
+    }
 
-    //Update stats
-    ++stats.pagesInUse;
-    stats.freeBlocks += settings.blocksPerPage;
+    if (settings.allocationOrder == AllocationOrder::Recent)
+    {
+      return;
+    }
 
-    if (stats.pagesInUse > stats.mostPagesInUse)
+    //Pick the best page with free blocks to allocate from next
+    PageHeader * best = pageList;
+    for (PageHeader * p = pageList; p != nullptr && HasFreeBlocks(p); p = p->next)
     {
-      stats.mostPagesInUse = stats.pagesInUse;
+      bool better = settings.allocationOrder == AllocationOrder::FullestPage ? p->liveBlocks > best->liveBlocks : p < best;
+      if (better)
+      {
+        best = p;
+      }
+    }
+
+    if (best != pageList && HasFreeBlocks(best))
+    {
+      Unlink(best);
+      LinkFront(best);
+    }
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::OnPageOpened(PageHeader * page)
+  {
+    if (page == pageList)
+    {
+      return;
+    }
+    Unlink(page);
+
+    //A page that was full is the fullest page. With LowestPage, the page being allocated from
+    //keeps its place unless this page is lower.
+    PageHeader * current = pageList;
+    if (settings.allocationOrder == AllocationOrder::LowestPage && current != nullptr && HasFreeBlocks(current) && current < page)
+    {
+      LinkAfter(current, page);
+    }
+    else
+    {
+      LinkFront(page);
+    }
+  }
+
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::Unlink(PageHeader * page)
+  {
+    if (page->prev != nullptr)
+    {
+      page->prev->next = page->next;
+    }
+    else
+    {
+      pageList = page->next;
+    }
+
+    if (page->next != nullptr)
+    {
+      page->next->prev = page->prev;
+    }
+    else
+    {
+      pageTail = page->prev;
     }
-#endif
   }
 
 #ifdef MEMORYMANAGER_DEBUG
-  template <typename T>
-  void ObjectAllocator<T>::DumpMemoryInUse(std::ostream & outputStream) const
+  template <typename T, typename Layout>
+  void ObjectAllocator<T, Layout>::DumpMemoryInUse(std::ostream & outputStream) const
   {
-    GenericObject * pages = pageList;
+    PageHeader * pages = pageList;
     while (pages)
     {
       //Walk through each block
       char * p = reinterpret_cast<char*>(pages);
       //Point to first block
-      p += sizeof(GenericObject*) + leftAlign + headerSize + settings.padBytes;
+      p += layout.firstBlockOffset;
       //Loop through blocks
-      for (unsigned i = 0; i < settings.blocksPerPage; ++i)
+      for (unsigned i = 0; i < layout.blocksPerPage; ++i)
       {
         //Check if block is still allocated
         DebugHeader const * dbg = GetDebugHeader(p);
-        if (dbg->allocated)
+        if (dbg->allocated && dbg->runBlocks != 0)
+        {
+          //Skip the rest of the array's blocks
+          outputStream << "Array of " << dbg->runBlocks << " blocks allocated at line #" << dbg->line << " in file " << dbg->filename;
+          i += dbg->runBlocks - 1;
+          p += (dbg->runBlocks - 1) * layout.interChunkSize;
+        }
+        else if (dbg->allocated)
         {
-          outputStream << blockSize << "b allocated at line #" << dbg->line << " in file " << dbg->filename;
+          outputStream << layout.blockSize << "b allocated at line #" << dbg->line << " in file " << dbg->filename;
         }
-        p += interChunkSize;
+        p += layout.interChunkSize;
       }
       pages = pages->next;
     }
   }
 
-  template <typename T>
-  DebugHeader const * ObjectAllocator<T>::GetDebugHeader(void const * mem) const
+  template <typename T, typename Layout>
+  DebugHeader const * ObjectAllocator<T, Layout>::GetDebugHeader(void const * mem) const
+  {
+    return reinterpret_cast<DebugHeader const *>(reinterpret_cast<char const*>(mem) - layout.padBytes - headerSize);
+  }
+#endif
+
+  /*
+    Allocates a batch of blocks and constructs an object in each. Used by MM_ALLOC_BATCH.
+    allocator - the allocator
+    count     - number of objects
+    objects   - receives the objects
+    construct - constructs an object in a block
+  */
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename Allocator, typename T, typename Construct>
+  void ConstructBatch(Allocator & allocator, unsigned count, T ** objects, Construct construct, char const * file, unsigned line)
+  {
+    allocator.AllocateBatch(count, objects, file, line);
+#else
+  template <typename Allocator, typename T, typename Construct>
+  void ConstructBatch(Allocator & allocator, unsigned count, T ** objects, Construct construct)
   {
-    return reinterpret_cast<DebugHeader const *>(reinterpret_cast<char const*>(mem) - settings.padBytes - headerSize);
+    allocator.AllocateBatch(count, objects);
+#endif
+    for (unsigned i = 0; i < count; ++i)
+    {
+      objects[i] = construct(objects[i]);
+    }
   }
+
+  /*
+    Allocates an array and constructs each of its objects. Used by MM_ALLOC_ARRAY.
+    allocator - the allocator
+    count     - number of objects
+    construct - constructs an object in a block
+  */
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T, typename Layout, typename Construct>
+  T * ConstructArray(ObjectAllocator<T, Layout> & allocator, unsigned count, Construct construct, char const * file, unsigned line)
+  {
+    T * objects = static_cast<T *>(allocator.AllocateArray(count, file, line));
+#else
+  template <typename T, typename Layout, typename Construct>
+  T * ConstructArray(ObjectAllocator<T, Layout> & allocator, unsigned count, Construct construct)
+  {
+    T * objects = static_cast<T *>(allocator.AllocateArray(count));
 #endif
+    for (unsigned i = 0; i < count; ++i)
+    {
+      construct(objects + i);
+    }
+    return objects;
+  }
 }
 
 #ifdef MEMORYMANAGER_DEBUG
 #define MM_ALLOC(allocator, constructor) (new (allocator.Allocate(__FILE__, __LINE__)) constructor)
 #define MM_FREE(allocator, pointer) (allocator.Free(pointer, __FILE__, __LINE__))
+#define MM_ALLOC_BATCH(allocator, count, objects, constructor) MemoryManager::ConstructBatch(allocator, count, objects, [&](void * mem) { return new (mem) constructor; }, __FILE__, __LINE__)
+#define MM_FREE_BATCH(allocator, objects, count) (allocator.FreeBatch(objects, count, __FILE__, __LINE__))
+#define MM_ALLOC_ARRAY(allocator, count, constructor) MemoryManager::ConstructArray(allocator, count, [&](void * mem) { return new (mem) constructor; }, __FILE__, __LINE__)
+#define MM_FREE_ARRAY(allocator, objects, count) (allocator.FreeArray(objects, count, __FILE__, __LINE__))
 #else
 #define MM_ALLOC(allocator, constructor) (new (allocator.Allocate()) constructor)
 #define MM_FREE(allocator, pointer) (allocator.Free(pointer))
+#define MM_ALLOC_BATCH(allocator, count, objects, constructor) MemoryManager::ConstructBatch(allocator, count, objects, [&](void * mem) { return new (mem) constructor; })
+#define MM_FREE_BATCH(allocator, objects, count) (allocator.FreeBatch(objects, count))
+#define MM_ALLOC_ARRAY(allocator, count, constructor) MemoryManager::ConstructArray(allocator, count, [&](void * mem) { return new (mem) constructor; })
+#define MM_FREE_ARRAY(allocator, objects, count) (allocator.FreeArray(objects, count))
 #endif
 
 #endif //AE_ObjectAllocator_h
\ No newline at end of file
@@ -0,0 +1,264 @@
+/*----------------------------------------------------
+PageSource.h
+
+Sources of page memory for the allocators.
+----------------------------------------------------*/
+#ifndef PageSource_h
+#define PageSource_h
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <mutex>
+#include <vector>
+#include <sys/mman.h>
+#include <unistd.h>
+#define MEMORYMANAGER_HAS_MMAP
+#endif
+
+// Size of an explicit huge page.
+#ifndef MEMORYMANAGER_HUGE_PAGE_SIZE
+#define MEMORYMANAGER_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#endif
+
+namespace MemoryManager
+{
+  // Interface for the memory backing allocator pages.
+  class PageSource
+  {
+  public:
+    // Destructor.
+    virtual ~PageSource() {}
+
+    /*
+      Allocates memory for a page. Returns null on failure.
+      size      - size of the page
+      alignment - alignment of the page. Always a power of two.
+    */
+    virtual void * AllocatePage(std::size_t size, std::size_t alignment) = 0;
+
+    /*
+      Returns a page to the source.
+      page      - the page
+      size      - size the page was allocated with
+      alignment - alignment the page was allocated with
+    */
+    virtual void ReleasePage(void * page, std::size_t size, std::size_t alignment) = 0;
+  };
+
+  // Allocates pages from the general-purpose heap. This is the default page source.
+  class HeapPageSource : public PageSource
+  {
+  public:
+    // Gets the shared instance. It is never destroyed, so allocators with static lifetime may use it.
+    static HeapPageSource & Instance()
+    {
+      static HeapPageSource * instance = new HeapPageSource();
+      return *instance;
+    }
+
+    virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+    {
+      return ::operator new(size, std::align_val_t(alignment), std::nothrow);
+    }
+
+    virtual void ReleasePage(void * page, std::size_t, std::size_t alignment)
+    {
+      ::operator delete(page, std::align_val_t(alignment));
+    }
+  };
+
+#ifdef MEMORYMANAGER_HAS_MMAP
+  // Huge page modes for MmapPageSource
+  enum class HugePages
+  {
+    // Use normal pages.
+    None,
+
+    // Ask for transparent huge pages with madvise(MADV_HUGEPAGE).
+    Transparent,
+
+    // Map explicit huge pages with MAP_HUGETLB. Falls back to transparent huge pages if none are available.
+    Explicit
+  };
+
+  // What MmapPageSource does with released pages.
+  enum class PageRelease
+  {
+    // Unmap the page.
+    Unmap,
+
+    // Keep the mapping for reuse, but give the memory back with madvise(MADV_DONTNEED).
+    DontNeed,
+
+    // Keep the mapping for reuse, and let the kernel reclaim the memory lazily with madvise(MADV_FREE).
+    Free
+  };
+
+  // Settings for MmapPageSource
+  struct MmapPageSourceSettings
+  {
+    // Huge page mode.
+    HugePages   hugePages = HugePages::None;
+
+    // What to do with released pages.
+    PageRelease release = PageRelease::Unmap;
+
+    // Most released pages to keep mapped when release is DontNeed or Free. Additional pages are unmapped.
+    unsigned    maxCachedPages = 64;
+  };
+
+  /*
+    Allocates pages with anonymous mmap, outside of the general-purpose heap. Huge pages reduce TLB
+    misses for large pools, but only pay off with pages of several megabytes. Released pages can be
+    kept mapped with their memory returned to the system, so the next page is created without a
+    system call to mmap. Safe to share between allocators on different threads.
+  */
+  class MmapPageSource : public PageSource
+  {
+    // A released page kept for reuse.
+    struct CachedPage
+    {
+      // The page.
+      void *      page;
+
+      // Mapped size of the page.
+      std::size_t size;
+    };
+
+    // Settings for the page source.
+    MmapPageSourceSettings  settings;
+
+    // Size of a system page.
+    std::size_t             systemPageSize;
+
+    // Guards the cache.
+    std::mutex              cacheLock;
+
+    // Released pages kept for reuse.
+    std::vector<CachedPage> cache;
+
+  public:
+    // Constructor.
+    MmapPageSource(MmapPageSourceSettings settings = MmapPageSourceSettings()) :
+      settings(settings),
+      systemPageSize(static_cast<std::size_t>(sysconf(_SC_PAGESIZE)))
+    {
+    }
+
+    // Destructor. Unmaps the cached pages.
+    virtual ~MmapPageSource()
+    {
+      for (CachedPage const & cached : cache)
+      {
+        munmap(cached.page, cached.size);
+      }
+    }
+
+    virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+    {
+      std::size_t mappedSize = MappedSize(size);
+
+      //Reuse a released page
+      if (settings.release != PageRelease::Unmap)
+      {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        for (std::size_t i = 0; i < cache.size(); ++i)
+        {
+          if (cache[i].size == mappedSize && (reinterpret_cast<std::uintptr_t>(cache[i].page) & (alignment - 1)) == 0)
+          {
+            void * page = cache[i].page;
+            cache[i] = cache.back();
+            cache.pop_back();
+            return page;
+          }
+        }
+      }
+
+      void * page = nullptr;
+#ifdef MAP_HUGETLB
+      if (settings.hugePages == HugePages::Explicit && alignment <= MEMORYMANAGER_HUGE_PAGE_SIZE)
+      {
+        //Huge page mappings are aligned to the huge page size
+        page = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (page != MAP_FAILED)
+        {
+          return page;
+        }
+      }
+#endif
+
+      page = MapAligned(mappedSize, alignment);
+#ifdef MADV_HUGEPAGE
+      if (page != nullptr && settings.hugePages != HugePages::None)
+      {
+        madvise(page, mappedSize, MADV_HUGEPAGE);
+      }
+#endif
+      return page;
+    }
+
+    virtual void ReleasePage(void * page, std::size_t size, std::size_t)
+    {
+      std::size_t mappedSize = MappedSize(size);
+      if (settings.release != PageRelease::Unmap)
+      {
+        std::lock_guard<std::mutex> lock(cacheLock);
+        if (cache.size() < settings.maxCachedPages)
+        {
+#ifdef MADV_FREE
+          madvise(page, mappedSize, settings.release == PageRelease::Free ? MADV_FREE : MADV_DONTNEED);
+#else
+          madvise(page, mappedSize, MADV_DONTNEED);
+#endif
+          cache.push_back(CachedPage{ page, mappedSize });
+          return;
+        }
+      }
+
+      munmap(page, mappedSize);
+    }
+
+  private:
+    // Gets the size to map for a page.
+    std::size_t MappedSize(std::size_t size) const
+    {
+      std::size_t granularity = settings.hugePages == HugePages::Explicit ? MEMORYMANAGER_HUGE_PAGE_SIZE : systemPageSize;
+      return (size + granularity - 1) & ~(granularity - 1);
+    }
+
+    // Maps memory aligned to the given alignment by over-mapping and unmapping the excess.
+    void * MapAligned(std::size_t size, std::size_t alignment)
+    {
+      std::size_t extra = alignment > systemPageSize ? alignment : 0;
+      char * raw = static_cast<char*>(mmap(nullptr, size + extra, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0));
+      if (raw == MAP_FAILED)
+      {
+        return nullptr;
+      }
+
+      if (extra == 0)
+      {
+        return raw;
+      }
+
+      char * aligned = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(raw) + alignment - 1) & ~static_cast<std::uintptr_t>(alignment - 1));
+      if (aligned != raw)
+      {
+        munmap(raw, aligned - raw);
+      }
+
+      std::size_t trailing = (raw + size + extra) - (aligned + size);
+      if (trailing != 0)
+      {
+        munmap(aligned + size, trailing);
+      }
+      return aligned;
+    }
+  };
+#endif // MEMORYMANAGER_HAS_MMAP
+}
+
+#endif // PageSource_h
@@ -7,10 +7,20 @@ Custom pointer class for memory handles.
 #ifndef Pointer_h
 #define Pointer_h
 
+#include <cassert>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
 #include "MemoryHandle.h"
 
 namespace MemoryManager
 {
+  template <typename T>
+  class PointerRef;
+
+  template <typename T>
+  class WeakPointer;
+
   // Pointer class that manages Handles to allocated memory.
   template <typename T>
   class Pointer
@@ -18,55 +28,87 @@ namespace MemoryManager
     template <typename U>
     friend class Pointer;
 
+    template <typename U>
+    friend class PointerRef;
+
+    template <typename U>
+    friend class WeakPointer;
+
+#ifdef MEMORYMANAGER_DEBUG
+    template <typename U>
+    friend unsigned char PointerFreeBatch(ObjectAllocator<U> & allocator, Pointer<U> * pointers, unsigned count, char const * file, unsigned line);
+#else
+    template <typename U>
+    friend void PointerFreeBatch(ObjectAllocator<U> & allocator, Pointer<U> * pointers, unsigned count);
+#endif
+
   public:
     // Default constructor. Initializes Pointer to null.
     Pointer() :
-      handle(&Handle::Null)
+      handle(Handle::Null)
     {
-      handle->AddRef();
+      handle.AddRef();
     }
 
     // Constructs a Pointer from a handle.
-    Pointer(Handle & handle) :
-      handle(&handle)
+    Pointer(Handle handle) :
+      handle(handle)
     {
-      this->handle->AddRef();
+      this->handle.AddRef();
     }
 
     // Constructs a null pointer.
     Pointer(std::nullptr_t p) :
-      handle(&Handle::Null)
+      handle(Handle::Null)
     {
-      handle->AddRef();
+      handle.AddRef();
     }
 
     // Copy constructor.
     Pointer(Pointer const & rhs) :
       handle(rhs.handle)
     {
-      handle->AddRef();
+      handle.AddRef();
     }
 
-    // Movement constructor.
+    // Movement constructor. Takes the reference of rhs and leaves it null.
     Pointer(Pointer && rhs) :
       handle(rhs.handle)
     {
-      handle->AddRef();
+      rhs.handle = Handle::Null;
     }
 
     // Copy constructor for a different pointer type.
     template <typename U>
-    Pointer(Pointer<U> & rhs) :
+    Pointer(Pointer<U> const & rhs) :
+      handle(rhs.handle)
+    {
+      T * p = (U*)nullptr;
+      handle.AddRef();
+    }
+
+    // Movement constructor for a different pointer type. Takes the reference of rhs and leaves it null.
+    template <typename U>
+    Pointer(Pointer<U> && rhs) :
+      handle(rhs.handle)
+    {
+      T * p = (U*)nullptr;
+      rhs.handle = Handle::Null;
+    }
+
+    // Constructs a Pointer that shares the handle of a borrowed pointer.
+    template <typename U>
+    explicit Pointer(PointerRef<U> const & rhs) :
       handle(rhs.handle)
     {
       T * p = (U*)nullptr;
-      handle->AddRef();
+      handle.AddRef();
     }
 
     // Destructor
     ~Pointer()
     {
-      handle->RemoveRef();
+      handle.RemoveRef();
     }
 
     // Assignment operator.
@@ -74,21 +116,21 @@ namespace MemoryManager
     {
       if (this != &rhs)
       {
-        handle->RemoveRef();
+        handle.RemoveRef();
         handle = rhs.handle;
-        handle->AddRef();
+        handle.AddRef();
       }
       return *this;
     }
 
-    // Move assignment operator.
+    // Move assignment operator. Takes the reference of rhs and leaves it null.
     Pointer & operator=(Pointer && rhs)
     {
       if (this != &rhs)
       {
-        handle->RemoveRef();
+        handle.RemoveRef();
         handle = rhs.handle;
-        handle->AddRef();
+        rhs.handle = Handle::Null;
       }
       return *this;
     }
@@ -96,9 +138,9 @@ namespace MemoryManager
     // Assignment operator for null.
     Pointer & operator=(std::nullptr_t const & rhs)
     {
-      handle->RemoveRef();
-      handle = &Handle::Null;
-      handle->AddRef();
+      handle.RemoveRef();
+      handle = Handle::Null;
+      handle.AddRef();
       return *this;
     }
 
@@ -107,9 +149,21 @@ namespace MemoryManager
     Pointer<T> & operator=(Pointer<U> const & rhs)
     {
       T * p = (U*)nullptr;
-      handle->RemoveRef();
+      handle.RemoveRef();
       handle = rhs.handle;
-      handle->AddRef();
+      handle.AddRef();
+
+      return *this;
+    }
+
+    // Move assignment operator for a different pointer type. Takes the reference of rhs and leaves it null.
+    template <typename U>
+    Pointer<T> & operator=(Pointer<U> && rhs)
+    {
+      T * p = (U*)nullptr;
+      handle.RemoveRef();
+      handle = rhs.handle;
+      rhs.handle = Handle::Null;
 
       return *this;
     }
@@ -117,7 +171,7 @@ namespace MemoryManager
     // Conversion operator to bool. Returns true if the handle is not null.
     inline operator bool() const
     {
-      return !handle->IsNull();
+      return !handle.IsNull();
     }
 
     // Equality operator. Returns true if pointers refer to the same handle.
@@ -135,43 +189,43 @@ namespace MemoryManager
     // Equality operator for null.
     inline bool operator==(std::nullptr_t const & rhs) const
     {
-      return handle->IsNull();
+      return handle.IsNull();
     }
 
     // Inequality operator for null.
     inline bool operator!=(std::nullptr_t const & rhs) const
     {
-      return !handle->IsNull();
+      return !handle.IsNull();
     }
 
     // Negation operator
     inline bool operator!() const
     {
-      return handle->IsNull();
+      return handle.IsNull();
     }
 
     // Dereference operator
     inline T & operator*()
     {
-      return *(handle->Get<T>());
+      return *(handle.Get<T>());
     }
 
     // Const dereference operator.
     inline T const & operator* () const
     {
-      return *(handle->Get<T const>());
+      return *(handle.Get<T const>());
     }
 
     // Access operator.
     inline T * operator->()
     {
-      return handle->Get<T>();
+      return handle.Get<T>();
     }
 
     // Const access operator
     inline T const * operator->() const
     {
-      return handle->Get<T const>();
+      return handle.Get<T const>();
     }
 
     // Casts pointer from type T to U with static_cast.
@@ -179,28 +233,28 @@ namespace MemoryManager
     Pointer<U> p_static_cast() const
     {
       U * p = static_cast<U *>(static_cast<T *>(nullptr));
-      return Pointer<U>(*handle);
+      return Pointer<U>(handle);
     }
 
     // Casts pointer from type T to U with dynamic_cast.
     template <typename U>
     Pointer<U> p_dynamic_cast() const
     {
-      U * p = dynamic_cast<U *>(static_cast<T *>(handle->GetRawPointer()));
+      U * p = dynamic_cast<U *>(static_cast<T *>(handle.GetRawPointer()));
       if (p == nullptr)
       {
         // Dynamic cast failed. Return a null pointer.
         return Pointer<U>();
       }
 
-      return Pointer<U>(*handle);
+      return Pointer<U>(handle);
     }
 
 #ifdef MEMORYMANAGER_DEBUG
     // Gets the handle referenced by the pointer.
-    Handle & GetHandle() const
+    Handle GetHandle() const
     {
-      return *handle;
+      return handle;
     }
 
     /*
@@ -210,25 +264,209 @@ namespace MemoryManager
     */
     inline void Free(const char * file, unsigned line)
     {
-      handle->Free<T>(file, line);
-      handle->RemoveRef(file, line);
-      handle = &Handle::Null;
-      handle->AddRef();
+      handle.Free<T>(file, line);
+      handle.RemoveRef(file, line);
+      handle = Handle::Null;
+      handle.AddRef();
     }
 #else
     inline void Free()
     {
-      handle->Free<T>();
-      handle->RemoveRef();
-      handle = &Handle::Null;
-      handle->AddRef();
+      handle.Free<T>();
+      handle.RemoveRef();
+      handle = Handle::Null;
+      handle.AddRef();
     }
 #endif
 
   private:
 
     // the handle references by the Pointer
-    Handle * handle;
+    Handle handle;
+  };
+
+  /*
+    Borrowed view of a Pointer. It refers to the same handle without adding a reference, so it can
+    be passed down call chains for free. Dangling access is still detected through the handle, but
+    a PointerRef must not outlive every Pointer to its handle, since the handle can then be reused.
+  */
+  template <typename T>
+  class PointerRef
+  {
+    template <typename U>
+    friend class Pointer;
+
+    template <typename U>
+    friend class PointerRef;
+
+  public:
+    // Default constructor. Initializes the view to null.
+    PointerRef() {}
+
+    // Constructs a null view.
+    PointerRef(std::nullptr_t p) {}
+
+    // Borrows a pointer.
+    template <typename U>
+    PointerRef(Pointer<U> const & pointer) :
+      handle(pointer.handle)
+    {
+      T * p = (U*)nullptr;
+    }
+
+    // Converts a view of a different pointer type.
+    template <typename U>
+    PointerRef(PointerRef<U> const & rhs) :
+      handle(rhs.handle)
+    {
+      T * p = (U*)nullptr;
+    }
+
+    // Conversion operator to bool. Returns true if the handle is not null.
+    inline operator bool() const
+    {
+      return !handle.IsNull();
+    }
+
+    // Equality operator. Returns true if the views refer to the same handle.
+    inline bool operator==(PointerRef const & rhs) const
+    {
+      return handle == rhs.handle;
+    }
+
+    // Inequality operator.
+    inline bool operator!=(PointerRef const & rhs) const
+    {
+      return handle != rhs.handle;
+    }
+
+    // Equality operator for null.
+    inline bool operator==(std::nullptr_t const & rhs) const
+    {
+      return handle.IsNull();
+    }
+
+    // Inequality operator for null.
+    inline bool operator!=(std::nullptr_t const & rhs) const
+    {
+      return !handle.IsNull();
+    }
+
+    // Negation operator
+    inline bool operator!() const
+    {
+      return handle.IsNull();
+    }
+
+    // Dereference operator
+    inline T & operator*() const
+    {
+      return *(handle.Get<T>());
+    }
+
+    // Access operator.
+    inline T * operator->() const
+    {
+      return handle.Get<T>();
+    }
+
+    // Gets a Pointer that adds a reference to the handle, to keep the memory's handle alive.
+    inline Pointer<T> Lock() const
+    {
+      return Pointer<T>(*this);
+    }
+
+  private:
+    // The handle of the borrowed pointer.
+    Handle handle;
+  };
+
+  /*
+    Weak reference to the object of a Pointer. It remembers the handle and the generation of its id
+    without adding a reference, so it does not keep the handle alive. Lock() returns a Pointer to the
+    object, or null once the object has been freed or the handle released.
+  */
+  template <typename T>
+  class WeakPointer
+  {
+    template <typename U>
+    friend class WeakPointer;
+
+  public:
+    // Default constructor. Initializes the weak pointer to null.
+    WeakPointer() :
+      generation(0)
+    {
+    }
+
+    // Constructs a null weak pointer.
+    WeakPointer(std::nullptr_t p) :
+      generation(0)
+    {
+    }
+
+    // Observes the object of a pointer.
+    template <typename U>
+    WeakPointer(Pointer<U> const & pointer) :
+      handle(pointer.handle),
+      generation(pointer.handle.GetGeneration())
+    {
+      T * p = (U*)nullptr;
+    }
+
+    // Converts a weak pointer of a different pointer type.
+    template <typename U>
+    WeakPointer(WeakPointer<U> const & rhs) :
+      handle(rhs.handle),
+      generation(rhs.generation)
+    {
+      T * p = (U*)nullptr;
+    }
+
+    // Assignment operator for null.
+    WeakPointer & operator=(std::nullptr_t const & rhs)
+    {
+      handle = Handle::Null;
+      generation = 0;
+      return *this;
+    }
+
+    // Gets a Pointer to the object, or a null Pointer if it has been freed.
+    inline Pointer<T> Lock() const
+    {
+      Pointer<T> pointer;
+      Handle observed = handle;
+      if (observed.TryAddRef(generation))
+      {
+        pointer.handle = observed;
+      }
+      return pointer;
+    }
+
+    // Checks whether the object has been freed or its handle released.
+    inline bool Expired() const
+    {
+      return handle.GetGeneration() != generation || handle.IsNull();
+    }
+
+    // Equality operator. Returns true if both observe the same handle.
+    inline bool operator==(WeakPointer const & rhs) const
+    {
+      return handle == rhs.handle && generation == rhs.generation;
+    }
+
+    // Inequality operator.
+    inline bool operator!=(WeakPointer const & rhs) const
+    {
+      return !(*this == rhs);
+    }
+
+  private:
+    // The observed handle.
+    Handle handle;
+
+    // Generation of the handle's id when it was observed.
+    std::uint32_t generation;
   };
 
   // Helper function that creates a handle and returns a pointer referencing the handle.
@@ -236,25 +474,177 @@ namespace MemoryManager
   template <typename T>
   Pointer<T> PointerAllocate(ObjectAllocator<T> & allocator, void * memory, char const * file, unsigned line)
   {
-    Handle & handle = Handle::CreateHandle(&allocator, memory, file, line);
+    Handle handle = Handle::CreateHandle(&allocator, memory, file, line);
     return Pointer<T>(handle);
   }
 #else
   template <typename T>
   Pointer<T> PointerAllocate(ObjectAllocator<T> & allocator, void * memory)
   {
-    Handle & handle = Handle::CreateHandle(&allocator, memory);
+    Handle handle = Handle::CreateHandle(&allocator, memory);
     return Pointer<T>(handle);
   }
 #endif
+
+  // Number of objects moved through the allocator at once by the batch pointer helpers.
+  static const unsigned PointerBatchSize = 64;
+
+  /*
+    Allocates a batch of objects, constructs each of them and creates a pointer for each.
+    Used by MM_PALLOC_BATCH.
+    allocator - the allocator
+    count     - number of objects
+    pointers  - receives the pointers
+    construct - constructs an object in a block
+  */
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T, typename Construct>
+  void PointerAllocateBatch(ObjectAllocator<T> & allocator, unsigned count, Pointer<T> * pointers, Construct construct, char const * file, unsigned line)
+#else
+  template <typename T, typename Construct>
+  void PointerAllocateBatch(ObjectAllocator<T> & allocator, unsigned count, Pointer<T> * pointers, Construct construct)
+#endif
+  {
+    T * objects[PointerBatchSize];
+    for (unsigned done = 0; done < count; done += PointerBatchSize)
+    {
+      unsigned batch = count - done < PointerBatchSize ? count - done : PointerBatchSize;
+#ifdef MEMORYMANAGER_DEBUG
+      allocator.AllocateBatch(batch, objects, file, line);
+      for (unsigned i = 0; i < batch; ++i)
+      {
+        pointers[done + i] = Pointer<T>(Handle::CreateHandle(&allocator, construct(objects[i]), file, line));
+      }
+#else
+      allocator.AllocateBatch(batch, objects);
+      for (unsigned i = 0; i < batch; ++i)
+      {
+        pointers[done + i] = Pointer<T>(Handle::CreateHandle(&allocator, construct(objects[i])));
+      }
+#endif
+    }
+  }
+
+  /*
+    Frees the objects of a batch of pointers and sets the pointers to null.
+    All pointers must refer to memory from the given allocator, which is asserted. Null pointers are ignored.
+    In debug builds, returns the error code of the first invalid free, or throws if exceptions are
+    enabled, like ObjectAllocator::FreeBatch. Without exceptions every pointer is still set to null.
+    Used by MM_PFREE_BATCH.
+    allocator - the allocator
+    pointers  - the pointers
+    count     - number of pointers
+  */
+#ifdef MEMORYMANAGER_DEBUG
+  template <typename T>
+  unsigned char PointerFreeBatch(ObjectAllocator<T> & allocator, Pointer<T> * pointers, unsigned count, char const * file, unsigned line)
+#else
+  template <typename T>
+  void PointerFreeBatch(ObjectAllocator<T> & allocator, Pointer<T> * pointers, unsigned count)
+#endif
+  {
+    T * objects[PointerBatchSize];
+#ifdef MEMORYMANAGER_DEBUG
+    unsigned char firstError = 0;
+#endif
+    for (unsigned done = 0; done < count; done += PointerBatchSize)
+    {
+      unsigned batch = count - done < PointerBatchSize ? count - done : PointerBatchSize;
+      for (unsigned i = 0; i < batch; ++i)
+      {
+        //A block of another allocator would be freed into the wrong pool
+        assert(pointers[done + i].handle.GetRawPointer() == nullptr || pointers[done + i].handle.GetAllocator() == &allocator);
+        objects[i] = static_cast<T *>(pointers[done + i].handle.DetachMemory());
+      }
+
+#ifdef MEMORYMANAGER_DEBUG
+      unsigned char errorCode = allocator.FreeBatch(objects, batch, file, line);
+      if (firstError == 0)
+      {
+        firstError = errorCode;
+      }
+#else
+      allocator.FreeBatch(objects, batch);
+#endif
+
+      for (unsigned i = 0; i < batch; ++i)
+      {
+        pointers[done + i] = nullptr;
+      }
+    }
+
+#ifdef MEMORYMANAGER_DEBUG
+    return firstError;
+#endif
+  }
+
+  /*
+    Whether objects of a type can be moved to another address by copying their bytes, without
+    running the move constructor and destructor. Specialize as true_type for types that hold no
+    pointers into themselves, such as types owning heap memory through a unique_ptr.
+  */
+  template <typename T>
+  struct IsTriviallyRelocatable : std::is_trivially_copyable<T> {};
+
+  /*
+    Moves an object to uninitialized memory and destroys the original.
+    from - the object
+    to   - the memory to move it to
+  */
+  template <typename T>
+  inline void RelocateObject(T * from, T * to)
+  {
+    if constexpr (IsTriviallyRelocatable<T>::value)
+    {
+      memcpy(static_cast<void *>(to), static_cast<void const *>(from), sizeof(T));
+    }
+    else
+    {
+      new (to) T(std::move(*from));
+      from->~T();
+    }
+  }
+
+  /*
+    Compacts an allocator whose objects are reached through Pointers. Objects are moved out of the
+    least occupied pages with RelocateObject, their handles are pointed at the new locations, and
+    the emptied pages are released. Objects without a handle stay in place. Returns the number of
+    pages released. Raw pointers and references to the objects are invalidated.
+    allocator - the allocator
+  */
+  template <typename T>
+  unsigned PointerCompact(ObjectAllocator<T> & allocator)
+  {
+    std::unordered_map<void *, Handle> handles;
+    Handle::ForEachHandle(&allocator, [&](Handle handle)
+    {
+      handles[handle.GetRawPointer()] = handle;
+    });
+
+    return allocator.Compact([&](T * from, T * to)
+    {
+      auto entry = handles.find(from);
+      if (entry == handles.end())
+      {
+        return false;
+      }
+      RelocateObject(from, to);
+      entry->second.Relocate(to);
+      return true;
+    });
+  }
 }
 
 #ifdef MEMORYMANAGER_DEBUG
 #define MM_PALLOC(allocator, constructor) MemoryManager::PointerAllocate(allocator, (void*)MM_ALLOC(allocator, constructor), __FILE__, __LINE__)
 #define MM_PFREE(pointer) pointer.Free(__FILE__, __LINE__)
+#define MM_PALLOC_BATCH(allocator, count, pointers, constructor) MemoryManager::PointerAllocateBatch(allocator, count, pointers, [&](void * mem) { return new (mem) constructor; }, __FILE__, __LINE__)
+#define MM_PFREE_BATCH(allocator, pointers, count) MemoryManager::PointerFreeBatch(allocator, pointers, count, __FILE__, __LINE__)
 #else
 #define MM_PALLOC(allocator, constructor) MemoryManager::PointerAllocate(allocator, (void*)MM_ALLOC(allocator, constructor))
 #define MM_PFREE(pointer) pointer.Free()
+#define MM_PALLOC_BATCH(allocator, count, pointers, constructor) MemoryManager::PointerAllocateBatch(allocator, count, pointers, [&](void * mem) { return new (mem) constructor; })
+#define MM_PFREE_BATCH(allocator, pointers, count) MemoryManager::PointerFreeBatch(allocator, pointers, count)
 #endif
 
 #endif // Pointer_h
@@ -0,0 +1,355 @@
+/*----------------------------------------------------
+PoolAllocator.h
+
+Standard library allocator and memory resource adapters
+over ObjectAllocator pools, for node-based containers.
+----------------------------------------------------*/
+
+#ifndef PoolAllocator_h
+#define PoolAllocator_h
+
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+#include "ObjectAllocator.h"
+#include "SmallObjectAllocator.h"
+
+namespace MemoryManager
+{
+  /*
+    Set of ObjectAllocator pools, one per block size and alignment. Shared by every PoolAllocator
+    rebound from the same allocator, so each node type a container rebinds to gets its own pool,
+    and node types of the same size and alignment share one. Pools are created the first time an
+    allocator for their size allocates or frees. Not thread-safe.
+  */
+  class PoolSet
+  {
+  public:
+    // Pool of one block size and alignment.
+    class Pool
+    {
+    public:
+      virtual ~Pool() {}
+      virtual unsigned Trim(unsigned maxEmptyPages) = 0;
+    };
+
+    // Pool of blocks of the given size and alignment.
+    template <std::size_t Size, std::size_t Align>
+    class PoolOf : public Pool
+    {
+    public:
+#ifdef MEMORYMANAGER_DEBUG
+      PoolOf(std::ostream * logStream, ObjectAllocatorSettings settings) : allocator(logStream, settings) {}
+#else
+      PoolOf(ObjectAllocatorSettings settings) : allocator(settings) {}
+#endif
+      virtual unsigned Trim(unsigned maxEmptyPages) { return allocator.Trim(maxEmptyPages); }
+
+      // The pool's allocator.
+      ObjectAllocator<RawBlock<Size, Align>> allocator;
+    };
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logStream - The log stream used by every pool
+      settings  - settings for every pool. The alignment is raised to the alignment of each pool's blocks.
+    */
+    PoolSet(std::ostream * logStream = nullptr, ObjectAllocatorSettings settings = ObjectAllocatorSettings()) :
+      logStream(logStream),
+      settings(settings)
+    {
+    }
+#else
+    PoolSet(ObjectAllocatorSettings settings = ObjectAllocatorSettings()) :
+      settings(settings)
+    {
+    }
+#endif
+
+    // Destructor. Frees every pool and its pages.
+    ~PoolSet()
+    {
+      for (Entry & entry : pools)
+      {
+        delete entry.pool;
+      }
+    }
+
+    // Gets the pool for blocks of the given size and alignment, creating it if needed.
+    template <std::size_t Size, std::size_t Align>
+    PoolOf<Size, Align> & GetPool()
+    {
+      for (Entry & entry : pools)
+      {
+        if (entry.size == Size && entry.alignment == Align)
+        {
+          return *static_cast<PoolOf<Size, Align> *>(entry.pool);
+        }
+      }
+
+#ifdef MEMORYMANAGER_DEBUG
+      PoolOf<Size, Align> * pool = new PoolOf<Size, Align>(logStream, settings);
+#else
+      PoolOf<Size, Align> * pool = new PoolOf<Size, Align>(settings);
+#endif
+      pools.push_back(Entry{Size, Align, pool});
+      return *pool;
+    }
+
+    /*
+      Returns empty pages of every pool to the page source. Returns the number of pages released.
+      maxEmptyPages - number of empty pages to keep per pool
+    */
+    unsigned Trim(unsigned maxEmptyPages = 0)
+    {
+      unsigned released = 0;
+      for (Entry & entry : pools)
+      {
+        released += entry.pool->Trim(maxEmptyPages);
+      }
+      return released;
+    }
+
+    // Gets the pool set used by default constructed PoolAllocators.
+    static PoolSet & Default()
+    {
+      static PoolSet instance;
+      return instance;
+    }
+
+  private:
+    // Prevent copy and assignment.
+    PoolSet(PoolSet const & rhs) = delete;
+    PoolSet & operator=(PoolSet const & rhs) = delete;
+
+    // A pool and the blocks it serves.
+    struct Entry
+    {
+      // Size of the blocks.
+      std::size_t size;
+
+      // Alignment of the blocks.
+      std::size_t alignment;
+
+      // The pool.
+      Pool *      pool;
+    };
+
+#ifdef MEMORYMANAGER_DEBUG
+    // Log stream used by every pool.
+    std::ostream *          logStream;
+#endif
+
+    // Settings for every pool.
+    ObjectAllocatorSettings settings;
+
+    // The pools. Containers use only a few node types, so they are searched in order.
+    std::vector<Entry>      pools;
+  };
+
+  /*
+    Allocator for standard containers that serves single objects from a pool of a PoolSet.
+    Node-based containers allocate one node at a time, so every node comes from the pool of the
+    node type the container rebinds to. Allocations of more than one object, such as the bucket
+    arrays of unordered containers, fall through to operator new.
+    The pool is looked up on first use, so T may be incomplete when the allocator is constructed,
+    as with containers of the type being declared. In debug builds the container, not user code,
+    allocates, so blocks are tagged with the name of the node type (typeid(T).name()) and line 0
+    instead of a file and line. Leak and invalid free reports name the node type.
+  */
+  template <typename T>
+  class PoolAllocator
+  {
+    template <typename U>
+    friend class PoolAllocator;
+
+  public:
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    // Default constructor. Uses the default pool set.
+    PoolAllocator() :
+      PoolAllocator(PoolSet::Default())
+    {
+    }
+
+    /*
+      Constructor.
+      pools - the pool set to allocate from. Must outlive every allocator using it.
+    */
+    PoolAllocator(PoolSet & pools) :
+      pools(&pools),
+      pool(nullptr)
+    {
+    }
+
+    // Rebinding constructor. Uses the pool set of rhs, and the pool for T.
+    template <typename U>
+    PoolAllocator(PoolAllocator<U> const & rhs) :
+      PoolAllocator(*rhs.pools)
+    {
+    }
+
+    // Allocates storage for count objects.
+    inline T * allocate(std::size_t count)
+    {
+      if (count == 1)
+      {
+#ifdef MEMORYMANAGER_DEBUG
+        return static_cast<T *>(GetPool().allocator.Allocate(typeid(T).name(), 0));
+#else
+        return static_cast<T *>(GetPool().allocator.Allocate());
+#endif
+      }
+      if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      {
+        return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(alignof(T))));
+      }
+      return static_cast<T *>(::operator new(count * sizeof(T)));
+    }
+
+    // Frees storage for count objects.
+    inline void deallocate(T * p, std::size_t count)
+    {
+      if (count == 1)
+      {
+#ifdef MEMORYMANAGER_DEBUG
+        GetPool().allocator.Free(p, typeid(T).name(), 0);
+#else
+        GetPool().allocator.Free(p);
+#endif
+      }
+      else if (alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+      {
+        ::operator delete(p, std::align_val_t(alignof(T)));
+      }
+      else
+      {
+        ::operator delete(p);
+      }
+    }
+
+    // Gets the pool set the allocator uses.
+    inline PoolSet & GetPoolSet() const
+    {
+      return *pools;
+    }
+
+    // Equality operator. Allocators are equal if they share a pool set.
+    template <typename U>
+    inline bool operator==(PoolAllocator<U> const & rhs) const
+    {
+      return pools == rhs.pools;
+    }
+
+    // Inequality operator.
+    template <typename U>
+    inline bool operator!=(PoolAllocator<U> const & rhs) const
+    {
+      return pools != rhs.pools;
+    }
+
+  private:
+    // Gets the pool for single objects, finding it on first use. Deduced, so T only needs to be complete once the allocator is used.
+    inline auto & GetPool() const
+    {
+      if (pool == nullptr)
+      {
+        pool = &pools->GetPool<sizeof(T), alignof(T)>();
+      }
+      return *static_cast<PoolSet::PoolOf<sizeof(T), alignof(T)> *>(pool);
+    }
+
+    // The pool set.
+    PoolSet *               pools;
+
+    // Pool for single objects. Found on first use.
+    mutable PoolSet::Pool * pool;
+  };
+
+  /*
+    Polymorphic memory resource over the size-class pools of a SmallObjectAllocator. Blocks up to
+    MaxSize with at most SmallObjectGranularity alignment come from the pools and are freed with
+    their size. Larger or more aligned blocks go to the upstream resource. Not thread-safe.
+  */
+  template <std::size_t MaxSize = 256>
+  class PoolResource : public std::pmr::memory_resource
+  {
+  public:
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      upstream  - resource for blocks the pools do not serve
+      logStream - The log stream to use
+      settings  - settings for the pools
+    */
+    PoolResource(std::pmr::memory_resource * upstream = std::pmr::get_default_resource(), std::ostream * logStream = nullptr, SmallObjectAllocatorSettings settings = SmallObjectAllocatorSettings()) :
+      allocator(logStream, settings),
+      upstream(upstream)
+    {
+    }
+#else
+    PoolResource(std::pmr::memory_resource * upstream = std::pmr::get_default_resource(), SmallObjectAllocatorSettings settings = SmallObjectAllocatorSettings()) :
+      allocator(settings),
+      upstream(upstream)
+    {
+    }
+#endif
+
+    /*
+      Returns empty pages of every size class to the page source. Returns the number of pages released.
+      maxEmptyPages - number of empty pages to keep per size class
+    */
+    unsigned Trim(unsigned maxEmptyPages = 0)
+    {
+      return allocator.Trim(maxEmptyPages);
+    }
+
+    // Gets the resource used for blocks the pools do not serve.
+    std::pmr::memory_resource * GetUpstream() const
+    {
+      return upstream;
+    }
+
+  protected:
+    virtual void * do_allocate(std::size_t bytes, std::size_t alignment)
+    {
+      if (bytes <= MaxSize && alignment <= SmallObjectGranularity)
+      {
+        return MM_SMALLOC(allocator, bytes);
+      }
+      return upstream->allocate(bytes, alignment);
+    }
+
+    virtual void do_deallocate(void * p, std::size_t bytes, std::size_t alignment)
+    {
+      if (bytes <= MaxSize && alignment <= SmallObjectGranularity)
+      {
+        MM_SFREE_SIZED(allocator, p, bytes);
+      }
+      else
+      {
+        upstream->deallocate(p, bytes, alignment);
+      }
+    }
+
+    virtual bool do_is_equal(std::pmr::memory_resource const & other) const noexcept
+    {
+      return this == &other;
+    }
+
+  private:
+    // Pools of the size classes.
+    SmallObjectAllocator<MaxSize> allocator;
+
+    // Resource for blocks the pools do not serve.
+    std::pmr::memory_resource *   upstream;
+  };
+}
+
+#endif // PoolAllocator_h
@@ -0,0 +1,548 @@
+/*----------------------------------------------------
+SmallObjectAllocator.h
+
+General purpose allocator for small blocks of any size, built on
+size-class ObjectAllocator pools.
+----------------------------------------------------*/
+#ifndef SmallObjectAllocator_h
+#define SmallObjectAllocator_h
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include "ObjectAllocator.h"
+
+namespace MemoryManager
+{
+  // Spacing between size classes. Also the alignment of every small block.
+  static const std::size_t SmallObjectGranularity = 16;
+
+  // Uninitialized storage used as the object type of size-class pools.
+  template <std::size_t Size, std::size_t Align = SmallObjectGranularity>
+  struct alignas(Align) RawBlock
+  {
+    unsigned char bytes[Size];
+  };
+
+  // Settings for SmallObjectAllocator
+  struct SmallObjectAllocatorSettings
+  {
+    // Size of each page, shared by every size class. Must be a power of two.
+    std::size_t   pageSize = 64 * 1024;
+
+    // Number of pad bytes
+#ifdef MEMORYMANAGER_DEBUG
+    unsigned      padBytes = 2;
+#else
+    unsigned      padBytes = 0;
+#endif
+
+    // Most empty pages each size class keeps.
+    unsigned      maxEmptyPages = 1;
+
+    // Most freed blocks each size class keeps for reuse without going through its pool. Not used in debug builds.
+    unsigned      cachedBlocks = 64;
+
+    // Source of page memory. Uses HeapPageSource if null. Must outlive the allocator.
+    PageSource *  pageSource = nullptr;
+  };
+
+  /*
+    Allocator for blocks of any size. Sizes up to MaxSize are rounded up to a multiple of
+    SmallObjectGranularity and served by one ObjectAllocator pool per size class, so unrelated
+    types of similar sizes share pages. Larger sizes fall back to operator new.
+    Every page of every size class has the same size and alignment, so blocks can also be freed
+    without their size. Like ObjectAllocator, it is not thread-safe.
+    MaxSize - largest size served by the pools. Must be a multiple of SmallObjectGranularity.
+  */
+  template <std::size_t MaxSize = 256>
+  class SmallObjectAllocator
+  {
+    static_assert(MaxSize > 0 && MaxSize % SmallObjectGranularity == 0, "MaxSize should be a multiple of SmallObjectGranularity.");
+
+    // Number of size classes.
+    static const unsigned ClassCount = static_cast<unsigned>(MaxSize / SmallObjectGranularity);
+
+    // Pool of blocks for one size class.
+    class SizeClassPool
+    {
+    public:
+      virtual ~SizeClassPool() {}
+#ifdef MEMORYMANAGER_DEBUG
+      virtual void * Allocate(char const * file, unsigned line) = 0;
+      virtual unsigned char Free(void * mem, char const * file, unsigned line) = 0;
+      virtual void DumpMemoryInUse(std::ostream & outputStream) const = 0;
+#else
+      virtual void * Allocate() = 0;
+      virtual void Free(void * mem) = 0;
+#endif
+#ifdef MEMORYMANAGER_STATS
+      virtual Stats GetStats() const = 0;
+#endif
+      virtual unsigned Trim(unsigned maxEmptyPages) = 0;
+    };
+
+    // Pool of blocks of the given size.
+    template <std::size_t Size>
+    class SizeClassPoolOf : public SizeClassPool
+    {
+      ObjectAllocator<RawBlock<Size>> allocator;
+
+    public:
+#ifdef MEMORYMANAGER_DEBUG
+      SizeClassPoolOf(std::ostream * logStream, ObjectAllocatorSettings settings) : allocator(logStream, settings) {}
+      virtual void * Allocate(char const * file, unsigned line) { return allocator.Allocate(file, line); }
+      virtual unsigned char Free(void * mem, char const * file, unsigned line) { return allocator.Free(mem, file, line); }
+      virtual void DumpMemoryInUse(std::ostream & outputStream) const { allocator.DumpMemoryInUse(outputStream); }
+#else
+      SizeClassPoolOf(ObjectAllocatorSettings settings) : allocator(settings) {}
+      virtual void * Allocate() { return allocator.Allocate(); }
+      virtual void Free(void * mem) { allocator.Free(mem); }
+#endif
+#ifdef MEMORYMANAGER_STATS
+      virtual Stats GetStats() const { return allocator.GetStats(); }
+#endif
+      virtual unsigned Trim(unsigned maxEmptyPages) { return allocator.Trim(maxEmptyPages); }
+    };
+
+    // Page source of one size class. Records which size class owns each page.
+    class SizeClassPageSource : public PageSource
+    {
+    public:
+      // Allocator the size class belongs to.
+      SmallObjectAllocator * owner = nullptr;
+
+      // Index of the size class.
+      unsigned sizeClass = 0;
+
+      virtual void * AllocatePage(std::size_t size, std::size_t alignment)
+      {
+        //Every page covers a whole aligned page, so no other memory shares its address range
+        assert(size <= owner->settings.pageSize && alignment <= owner->settings.pageSize);
+        static_cast<void>(size);
+        static_cast<void>(alignment);
+        void * page = owner->settings.pageSource->AllocatePage(owner->settings.pageSize, owner->settings.pageSize);
+        if (page != nullptr)
+        {
+          owner->pageClasses[reinterpret_cast<std::uintptr_t>(page)] = sizeClass;
+        }
+        return page;
+      }
+
+      virtual void ReleasePage(void * page, std::size_t, std::size_t)
+      {
+        owner->pageClasses.erase(reinterpret_cast<std::uintptr_t>(page));
+        owner->settings.pageSource->ReleasePage(page, owner->settings.pageSize, owner->settings.pageSize);
+      }
+    };
+
+    // Prevent copy and assignment.
+    SmallObjectAllocator(SmallObjectAllocator const & rhs) = delete;
+    SmallObjectAllocator & operator=(SmallObjectAllocator const & rhs) = delete;
+
+    // Settings for the allocator.
+    SmallObjectAllocatorSettings  settings;
+
+    // Page sources of the size classes.
+    SizeClassPageSource           sources[ClassCount];
+
+    // Pools of the size classes.
+    SizeClassPool *               pools[ClassCount];
+
+    // Size class of each page, by page address. Used to free blocks without their size.
+    std::unordered_map<std::uintptr_t, unsigned> pageClasses;
+
+#ifndef MEMORYMANAGER_DEBUG
+    // Freed blocks of a size class kept for reuse.
+    struct BlockCache
+    {
+      // The blocks.
+      GenericObject * blocks = nullptr;
+
+      // Number of blocks.
+      unsigned        count = 0;
+#ifdef MEMORYMANAGER_STATS
+
+      // Number of allocations served from the cache.
+      std::uint64_t   allocations = 0;
+
+      // Number of frees kept in the cache.
+      std::uint64_t   deallocations = 0;
+#endif
+    };
+
+    // Freed blocks of each size class. Debug builds free through the pools so every free is validated.
+    BlockCache                    caches[ClassCount];
+#endif
+
+  public:
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Constructor.
+      logStream - The log stream to use
+      settings  - settings for the allocator
+    */
+    SmallObjectAllocator(std::ostream * logStream = nullptr, SmallObjectAllocatorSettings settings = SmallObjectAllocatorSettings());
+#else
+    SmallObjectAllocator(SmallObjectAllocatorSettings settings = SmallObjectAllocatorSettings());
+#endif
+
+    /*
+      Destructor.
+      Cleans up pages. In debug mode, dumps all remaining used blocks to the log stream.
+    */
+    ~SmallObjectAllocator();
+
+    // Gets the size class for a size. Sizes above MaxSize have no size class and return ClassCount.
+    static inline unsigned GetSizeClass(std::size_t size)
+    {
+      return size == 0 ? 0 : size <= MaxSize ? static_cast<unsigned>((size - 1) / SmallObjectGranularity) : ClassCount;
+    }
+
+#ifdef MEMORYMANAGER_DEBUG
+    /*
+      Dumps all memory in use to the output stream. Large blocks are not tracked.
+      outputStream - output stream to dump to.
+    */
+    void DumpMemoryInUse(std::ostream & outputStream) const;
+
+    /*
+      Allocates and returns a block.
+      size - size of the block
+      file - the file the allocation came from. Used in debug header.
+      line - the line the allocation came from. Used in debug header.
+    */
+    void * Allocate(std::size_t size, char const * file, unsigned line);
+
+    /*
+      Frees a block. The size is found from the block's page. Checks the validity of the free
+      and returns an error code or throws if the free is invalid. Large blocks are not validated.
+      mem  - the block to free.
+      file - the file the free came from.
+      line - the line the free came from.
+    */
+    unsigned char Free(void * mem, char const * file, unsigned line);
+
+    /*
+      Frees a block that was allocated with the given size, without looking up its page.
+      mem  - the block to free.
+      size - the size the block was allocated with.
+      file - the file the free came from.
+      line - the line the free came from.
+    */
+    unsigned char Free(void * mem, std::size_t size, char const * file, unsigned line);
+#else
+    void * Allocate(std::size_t size);
+    void Free(void * mem);
+    void Free(void * mem, std::size_t size);
+#endif
+
+    /*
+      Returns cached blocks to their pools and empty pages of every size class to the page source.
+      Returns the number of pages released.
+      maxEmptyPages - number of empty pages to keep per size class
+    */
+    unsigned Trim(unsigned maxEmptyPages = 0);
+
+#ifdef MEMORYMANAGER_STATS
+    /*
+      Get statistics summed over every size class. Large blocks are not counted, and cached
+      blocks are counted as free. The most blocks and pages in use are summed over size classes.
+    */
+    Stats GetStats() const;
+#endif
+
+  private:
+    // Gets the size class owning a small block, or ClassCount if the block is large.
+    inline unsigned FindSizeClass(void const * mem) const
+    {
+      auto page = pageClasses.find(reinterpret_cast<std::uintptr_t>(mem) & ~static_cast<std::uintptr_t>(settings.pageSize - 1));
+      return page == pageClasses.end() ? ClassCount : page->second;
+    }
+
+    // Creates the pool of every size class.
+#ifdef MEMORYMANAGER_DEBUG
+    template <std::size_t... Index>
+    void CreatePools(std::ostream * logStream, std::index_sequence<Index...>);
+#else
+    template <std::size_t... Index>
+    void CreatePools(std::index_sequence<Index...>);
+#endif
+
+    // Gets the settings for the pool of a size class.
+    ObjectAllocatorSettings GetPoolSettings(unsigned sizeClass);
+
+#ifndef MEMORYMANAGER_DEBUG
+    // Frees a small block through the cache of its size class.
+    inline void FreeSmall(void * mem, unsigned sizeClass)
+    {
+      BlockCache & cache = caches[sizeClass];
+      if (cache.count < settings.cachedBlocks)
+      {
+        Push(cache.blocks, static_cast<GenericObject *>(mem));
+        ++cache.count;
+#ifdef MEMORYMANAGER_STATS
+        ++cache.deallocations;
+#endif
+      }
+      else
+      {
+        pools[sizeClass]->Free(mem);
+      }
+    }
+#endif
+  };
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <std::size_t MaxSize>
+  SmallObjectAllocator<MaxSize>::SmallObjectAllocator(std::ostream * logStream, SmallObjectAllocatorSettings settings) :
+#else
+  template <std::size_t MaxSize>
+  SmallObjectAllocator<MaxSize>::SmallObjectAllocator(SmallObjectAllocatorSettings settings) :
+#endif
+    settings(settings)
+  {
+    if (this->settings.pageSource == nullptr)
+    {
+      this->settings.pageSource = &HeapPageSource::Instance();
+    }
+    assert(NextPowerOfTwo(this->settings.pageSize) == this->settings.pageSize);
+
+    for (unsigned i = 0; i < ClassCount; ++i)
+    {
+      sources[i].owner = this;
+      sources[i].sizeClass = i;
+    }
+
+#ifdef MEMORYMANAGER_DEBUG
+    CreatePools(logStream, std::make_index_sequence<ClassCount>());
+#else
+    CreatePools(std::make_index_sequence<ClassCount>());
+#endif
+  }
+
+  template <std::size_t MaxSize>
+  SmallObjectAllocator<MaxSize>::~SmallObjectAllocator()
+  {
+    for (SizeClassPool * pool : pools)
+    {
+      delete pool;
+    }
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <std::size_t MaxSize>
+  template <std::size_t... Index>
+  void SmallObjectAllocator<MaxSize>::CreatePools(std::ostream * logStream, std::index_sequence<Index...>)
+  {
+    SizeClassPool * created[] = { new SizeClassPoolOf<(Index + 1) * SmallObjectGranularity>(logStream, GetPoolSettings(Index))... };
+#else
+  template <std::size_t MaxSize>
+  template <std::size_t... Index>
+  void SmallObjectAllocator<MaxSize>::CreatePools(std::index_sequence<Index...>)
+  {
+    SizeClassPool * created[] = { new SizeClassPoolOf<(Index + 1) * SmallObjectGranularity>(GetPoolSettings(Index))... };
+#endif
+    for (unsigned i = 0; i < ClassCount; ++i)
+    {
+      pools[i] = created[i];
+    }
+  }
+
+  template <std::size_t MaxSize>
+  ObjectAllocatorSettings SmallObjectAllocator<MaxSize>::GetPoolSettings(unsigned sizeClass)
+  {
+#ifdef MEMORYMANAGER_DEBUG
+    unsigned headerSize = sizeof(DebugHeader);
+#else
+    unsigned headerSize = 0;
+#endif
+
+    //Lay out a page of one block to find the real stride, then fill the page with as many blocks as fit
+    PageGeometry single((sizeClass + 1) * SmallObjectGranularity, SmallObjectGranularity, headerSize, 1, SmallObjectGranularity, settings.padBytes, FreeTracking::List);
+    assert(settings.pageSize >= single.pageSize);
+
+    ObjectAllocatorSettings poolSettings;
+    poolSettings.blocksPerPage = static_cast<unsigned>((settings.pageSize - single.pageHeaderSize - single.leftAlign + single.interAlign) / single.blockStride);
+    poolSettings.padBytes = settings.padBytes;
+    poolSettings.alignment = SmallObjectGranularity;
+    poolSettings.maxEmptyPages = settings.maxEmptyPages;
+    poolSettings.pageSource = &sources[sizeClass];
+    return poolSettings;
+  }
+
+#ifdef MEMORYMANAGER_DEBUG
+  template <std::size_t MaxSize>
+  void * SmallObjectAllocator<MaxSize>::Allocate(std::size_t size, char const * file, unsigned line)
+  {
+    unsigned sizeClass = GetSizeClass(size);
+    return sizeClass < ClassCount ? pools[sizeClass]->Allocate(file, line) : ::operator new(size);
+  }
+
+  template <std::size_t MaxSize>
+  unsigned char SmallObjectAllocator<MaxSize>::Free(void * mem, char const * file, unsigned line)
+  {
+    if (mem == nullptr)
+    {
+      return 0;
+    }
+
+    unsigned sizeClass = FindSizeClass(mem);
+    if (sizeClass == ClassCount)
+    {
+      ::operator delete(mem);
+      return 0;
+    }
+    return pools[sizeClass]->Free(mem, file, line);
+  }
+
+  template <std::size_t MaxSize>
+  unsigned char SmallObjectAllocator<MaxSize>::Free(void * mem, std::size_t size, char const * file, unsigned line)
+  {
+    if (mem == nullptr)
+    {
+      return 0;
+    }
+
+    unsigned sizeClass = GetSizeClass(size);
+    if (sizeClass == ClassCount)
+    {
+      ::operator delete(mem);
+      return 0;
+    }
+    return pools[sizeClass]->Free(mem, file, line);
+  }
+
+  template <std::size_t MaxSize>
+  void SmallObjectAllocator<MaxSize>::DumpMemoryInUse(std::ostream & outputStream) const
+  {
+    for (SizeClassPool const * pool : pools)
+    {
+      pool->DumpMemoryInUse(outputStream);
+    }
+  }
+#else
+  template <std::size_t MaxSize>
+  void * SmallObjectAllocator<MaxSize>::Allocate(std::size_t size)
+  {
+    unsigned sizeClass = GetSizeClass(size);
+    if (sizeClass == ClassCount)
+    {
+      return ::operator new(size);
+    }
+
+    BlockCache & cache = caches[sizeClass];
+    if (cache.blocks != nullptr)
+    {
+      --cache.count;
+#ifdef MEMORYMANAGER_STATS
+      ++cache.allocations;
+#endif
+      return Pop(cache.blocks);
+    }
+    return pools[sizeClass]->Allocate();
+  }
+
+  template <std::size_t MaxSize>
+  void SmallObjectAllocator<MaxSize>::Free(void * mem)
+  {
+    if (mem != nullptr)
+    {
+      unsigned sizeClass = FindSizeClass(mem);
+      if (sizeClass == ClassCount)
+      {
+        ::operator delete(mem);
+      }
+      else
+      {
+        FreeSmall(mem, sizeClass);
+      }
+    }
+  }
+
+  template <std::size_t MaxSize>
+  void SmallObjectAllocator<MaxSize>::Free(void * mem, std::size_t size)
+  {
+    if (mem != nullptr)
+    {
+      unsigned sizeClass = GetSizeClass(size);
+      if (sizeClass == ClassCount)
+      {
+        ::operator delete(mem);
+      }
+      else
+      {
+        FreeSmall(mem, sizeClass);
+      }
+    }
+  }
+#endif
+
+  template <std::size_t MaxSize>
+  unsigned SmallObjectAllocator<MaxSize>::Trim(unsigned maxEmptyPages)
+  {
+    unsigned released = 0;
+    for (unsigned i = 0; i < ClassCount; ++i)
+    {
+#ifndef MEMORYMANAGER_DEBUG
+      //Cached blocks keep their pages in use. Their frees are counted again by the pool
+#ifdef MEMORYMANAGER_STATS
+      caches[i].deallocations -= caches[i].count;
+#endif
+      while (caches[i].blocks != nullptr)
+      {
+        pools[i]->Free(Pop(caches[i].blocks));
+      }
+      caches[i].count = 0;
+#endif
+      released += pools[i]->Trim(maxEmptyPages);
+    }
+    return released;
+  }
+
+#ifdef MEMORYMANAGER_STATS
+  template <std::size_t MaxSize>
+  Stats SmallObjectAllocator<MaxSize>::GetStats() const
+  {
+    Stats total;
+    for (SizeClassPool const * pool : pools)
+    {
+      Stats stats = pool->GetStats();
+      total.freeBlocks += stats.freeBlocks;
+      total.blocksInUse += stats.blocksInUse;
+      total.pagesInUse += stats.pagesInUse;
+      total.mostBlocksInUse += stats.mostBlocksInUse;
+      total.mostPagesInUse += stats.mostPagesInUse;
+      total.allocations += stats.allocations;
+      total.deallocations += stats.deallocations;
+    }
+
+#ifndef MEMORYMANAGER_DEBUG
+    //Cached blocks are in use as far as the pools are concerned
+    for (BlockCache const & cache : caches)
+    {
+      total.blocksInUse -= cache.count;
+      total.freeBlocks += cache.count;
+      total.allocations += cache.allocations;
+      total.deallocations += cache.deallocations;
+    }
+#endif
+    return total;
+  }
+#endif
+}
+
+#ifdef MEMORYMANAGER_DEBUG
+#define MM_SMALLOC(allocator, size) (allocator).Allocate(size, __FILE__, __LINE__)
+#define MM_SFREE(allocator, mem) (allocator).Free(mem, __FILE__, __LINE__)
+#define MM_SFREE_SIZED(allocator, mem, size) (allocator).Free(mem, size, __FILE__, __LINE__)
+#else
+#define MM_SMALLOC(allocator, size) (allocator).Allocate(size)
+#define MM_SFREE(allocator, mem) (allocator).Free(mem)
+#define MM_SFREE_SIZED(allocator, mem, size) (allocator).Free(mem, size)
+#endif
+
+#endif // SmallObjectAllocator_h
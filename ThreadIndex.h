@@ -0,0 +1,185 @@
+/*----------------------------------------------------
+ThreadIndex.h
+
+Small per-thread indices and per-thread counters.
+----------------------------------------------------*/
+#ifndef ThreadIndex_h
+#define ThreadIndex_h
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Maximum number of threads that get their own index. Additional threads share per-thread data through a fallback path.
+#ifndef MEMORYMANAGER_MAX_THREADS
+#define MEMORYMANAGER_MAX_THREADS 64
+#endif
+
+// Size of a cache line. Per-thread data is aligned to this to prevent false sharing.
+#ifndef MEMORYMANAGER_CACHE_LINE_SIZE
+#define MEMORYMANAGER_CACHE_LINE_SIZE 64
+#endif
+
+namespace MemoryManager
+{
+  /*
+    Base of objects that cache blocks per thread index. Registered owners are told when a thread
+    with an index exits, so the blocks cached for it are returned before its index is reused.
+  */
+  class ThreadCacheOwner
+  {
+    friend class ThreadIndex;
+
+  public:
+    /*
+      Returns the blocks cached for an exiting thread. Called on that thread, before its index is released.
+      index - index of the exiting thread
+    */
+    virtual void FlushThread(unsigned index) = 0;
+
+  protected:
+    // Destructor.
+    virtual ~ThreadCacheOwner() {}
+
+    // Starts telling the owner about exiting threads. Called once the owner is fully constructed.
+    void RegisterThreadExit()
+    {
+      std::lock_guard<std::mutex> lock(Lock());
+      Owners().push_back(this);
+    }
+
+    // Stops telling the owner about exiting threads. Called before the owner is destroyed. Waits for a flush in progress.
+    void UnregisterThreadExit()
+    {
+      std::lock_guard<std::mutex> lock(Lock());
+      std::vector<ThreadCacheOwner *> & owners = Owners();
+      owners.erase(std::find(owners.begin(), owners.end(), this));
+    }
+
+  private:
+    // Tells every registered owner that the thread with the given index is exiting.
+    static void ThreadExited(unsigned index)
+    {
+      std::lock_guard<std::mutex> lock(Lock());
+      for (ThreadCacheOwner * owner : Owners())
+      {
+        owner->FlushThread(index);
+      }
+    }
+
+    // Guards the registered owners. Never destroyed, so threads exiting during shutdown may use it.
+    static std::mutex & Lock()
+    {
+      static std::mutex * lock = new std::mutex();
+      return *lock;
+    }
+
+    // The registered owners. Never destroyed, so threads exiting during shutdown may use it.
+    static std::vector<ThreadCacheOwner *> & Owners()
+    {
+      static std::vector<ThreadCacheOwner *> * owners = new std::vector<ThreadCacheOwner *>();
+      return *owners;
+    }
+  };
+
+  // Assigns each thread a small index used to find its caches. Indices are recycled when threads exit, after the thread's caches are flushed.
+  class ThreadIndex
+  {
+  public:
+    // Gets the index of the calling thread. Returns MEMORYMANAGER_MAX_THREADS if every index is taken.
+    static inline unsigned Current()
+    {
+      static thread_local ThreadIndex index;
+      return index.value;
+    }
+
+  private:
+    ThreadIndex() : value(MEMORYMANAGER_MAX_THREADS)
+    {
+      std::atomic<bool> * slots = Slots();
+      for (unsigned i = 0; i < MEMORYMANAGER_MAX_THREADS; ++i)
+      {
+        bool expected = false;
+        if (!slots[i].load(std::memory_order_relaxed) && slots[i].compare_exchange_strong(expected, true, std::memory_order_acquire))
+        {
+          value = i;
+          break;
+        }
+      }
+    }
+
+    ~ThreadIndex()
+    {
+      if (value < MEMORYMANAGER_MAX_THREADS)
+      {
+        ThreadCacheOwner::ThreadExited(value);
+        Slots()[value].store(false, std::memory_order_release);
+      }
+    }
+
+    // Flags for the indices currently claimed by a thread.
+    static std::atomic<bool> * Slots()
+    {
+      static std::atomic<bool> slots[MEMORYMANAGER_MAX_THREADS] = {};
+      return slots;
+    }
+
+    // Index of the thread.
+    unsigned value;
+  };
+
+  /*
+    Counters kept separately by each thread and summed when read, so counting from many threads
+    does not bounce a shared cache line between cores. Each thread only writes its own counters,
+    so counting is a plain load and store. Threads without an index share an extra set of
+    counters updated with atomic adds.
+    Count - number of counters
+  */
+  template <unsigned Count>
+  class ThreadCounters
+  {
+    // Counters of one thread.
+    struct alignas(MEMORYMANAGER_CACHE_LINE_SIZE) Slot
+    {
+      std::atomic<std::uint64_t> values[Count] = {};
+    };
+
+    // Counters of each thread index, followed by the counters shared by threads without an index.
+    Slot slots[MEMORYMANAGER_MAX_THREADS + 1];
+
+  public:
+    /*
+      Adds to a counter of the calling thread.
+      counter - index of the counter
+      amount  - amount to add
+    */
+    inline void Add(unsigned counter, std::uint64_t amount)
+    {
+      unsigned index = ThreadIndex::Current();
+      std::atomic<std::uint64_t> & value = slots[index].values[counter];
+      if (index < MEMORYMANAGER_MAX_THREADS)
+      {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+      }
+      else
+      {
+        value.fetch_add(amount, std::memory_order_relaxed);
+      }
+    }
+
+    // Sums a counter over every thread.
+    std::uint64_t Sum(unsigned counter) const
+    {
+      std::uint64_t sum = 0;
+      for (Slot const & slot : slots)
+      {
+        sum += slot.values[counter].load(std::memory_order_relaxed);
+      }
+      return sum;
+    }
+  };
+}
+
+#endif // ThreadIndex_h